@@ -0,0 +1,215 @@
+#pragma once
+
+#include "intrusive_list.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+template <class T>
+struct IdentityKey {
+    const T& operator()(const T& elem) const {
+        return elem;
+    }
+};
+
+template <class T, class Key>
+struct GetKeyOf {
+    const Key& operator()(const T& elem) const {
+        return elem.GetKey();
+    }
+};
+
+// Open hashing table over objects that embed `Hook`. Bucket chains are the
+// same circular ListHook chains List uses, so an element can be erased in O(1)
+// just by unlinking it, and the table never allocates per element.
+//
+// The table grows incrementally: once there are more elements than buckets,
+// a bucket array twice as big is allocated and every following operation
+// moves a couple of old buckets into it. No single operation pays for the
+// whole rehash. Use Reserve to avoid growing at all.
+template <class T, class Key, class KeyOf, class Hash = std::hash<Key>, class Hook = ListHook>
+class IntrusiveHashTable {
+public:
+    explicit IntrusiveHashTable(size_t bucket_count = 16) {
+        table_ = MakeTable(bucket_count);
+    }
+
+    IntrusiveHashTable(const IntrusiveHashTable&) = delete;
+    IntrusiveHashTable& operator=(const IntrusiveHashTable&) = delete;
+
+    // Unlinks all elements, so they can outlive the table
+    ~IntrusiveHashTable() {
+        Clear();
+    }
+
+    T* Find(const Key& key) {
+        Step();
+        return FindIn(Bucket(hash_(key)), key);
+    }
+
+    // Returns false and doesn't link elem if an element with the same key is
+    // already in the table.
+    bool Insert(T* elem) {
+        Step();
+        const Key& key = KeyOf()(*elem);
+        ListHook* bucket = Bucket(hash_(key));
+        if (FindIn(bucket, key)) {
+            return false;
+        }
+        // grow before linking, so a failed allocation leaves elem out
+        if (!old_.buckets && size_ + 1 > BucketCount()) {
+            StartRehash(BucketCount() * 2);
+            bucket = Bucket(hash_(key));
+        }
+        ToHook(elem)->LinkBefore(bucket->next_);
+        ++size_;
+        return true;
+    }
+
+    // elem must be linked into this table
+    void Erase(T* elem) {
+        ToHook(elem)->Unlink();
+        --size_;
+        Step();
+    }
+
+    T* Extract(const Key& key) {
+        T* elem = Find(key);
+        if (elem) {
+            Erase(elem);
+        }
+        return elem;
+    }
+
+    // Finishes pending rehash and grows the table to at least count buckets
+    // right away.
+    void Reserve(size_t count) {
+        FinishRehash();
+        if (count > BucketCount()) {
+            StartRehash(count);
+            FinishRehash();
+        }
+    }
+
+    void Clear() {
+        UnlinkAll(table_);
+        UnlinkAll(old_);
+        old_ = Table{};
+        size_ = 0;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool IsEmpty() const {
+        return size_ == 0;
+    }
+
+    size_t BucketCount() const {
+        return table_.mask + 1;
+    }
+
+private:
+    // Number of old buckets moved by each operation while rehashing.
+    // Table grows when Size() > BucketCount(), and rehash must be over before
+    // Size() doubles, so anything >= 1 works.
+    static constexpr size_t kRehashStep = 2;
+
+    struct Table {
+        std::unique_ptr<ListHook[]> buckets;
+        size_t mask = 0;
+    };
+
+    static Table MakeTable(size_t bucket_count) {
+        size_t count = 1;
+        while (count < bucket_count) {
+            count <<= 1;
+        }
+        return Table{std::unique_ptr<ListHook[]>(new ListHook[count]), count - 1};
+    }
+
+    static ListHook* ToHook(T* elem) {
+        return static_cast<Hook*>(elem);
+    }
+
+    static T& Cast(ListHook* hook) {
+        return static_cast<T&>(static_cast<Hook&>(*hook));
+    }
+
+    // Element lives in the old table iff its old bucket wasn't moved yet.
+    ListHook* Bucket(size_t hash) {
+        if (old_.buckets && (hash & old_.mask) >= rehash_pos_) {
+            return &old_.buckets[hash & old_.mask];
+        }
+        return &table_.buckets[hash & table_.mask];
+    }
+
+    T* FindIn(ListHook* bucket, const Key& key) {
+        for (ListHook* now = bucket->next_; now != bucket; now = now->next_) {
+            if (KeyOf()(Cast(now)) == key) {
+                return &Cast(now);
+            }
+        }
+        return nullptr;
+    }
+
+    void StartRehash(size_t bucket_count) {
+        Table table = MakeTable(bucket_count);
+        old_ = std::move(table_);
+        table_ = std::move(table);
+        rehash_pos_ = 0;
+    }
+
+    void Step() {
+        for (size_t i = 0; i < kRehashStep && old_.buckets; ++i) {
+            MoveBucket();
+        }
+    }
+
+    void FinishRehash() {
+        while (old_.buckets) {
+            MoveBucket();
+        }
+    }
+
+    void MoveBucket() {
+        ListHook* bucket = &old_.buckets[rehash_pos_];
+        while (bucket->next_ != bucket) {
+            ListHook* hook = bucket->next_;
+            hook->Unlink();
+            ListHook* target = &table_.buckets[hash_(KeyOf()(Cast(hook))) & table_.mask];
+            hook->LinkBefore(target->next_);
+        }
+        if (++rehash_pos_ > old_.mask) {
+            old_ = Table{};
+        }
+    }
+
+    static void UnlinkAll(Table& table) {
+        if (!table.buckets) {
+            return;
+        }
+        for (size_t i = 0; i <= table.mask; ++i) {
+            ListHook* bucket = &table.buckets[i];
+            while (bucket->next_ != bucket) {
+                bucket->next_->Unlink();
+            }
+        }
+    }
+
+    Table table_;
+    Table old_;
+    size_t rehash_pos_ = 0;
+    size_t size_ = 0;
+    Hash hash_;
+};
+
+// Elements are keys themselves
+template <class T, class Hash = std::hash<T>, class Hook = ListHook>
+using IntrusiveHashSet = IntrusiveHashTable<T, T, IdentityKey<T>, Hash, Hook>;
+
+// Elements expose `const Key& GetKey() const`
+template <class T, class Key, class Hash = std::hash<Key>, class Hook = ListHook>
+using IntrusiveHashMap = IntrusiveHashTable<T, Key, GetKeyOf<T, Key>, Hash, Hook>;
@@ -2,6 +2,11 @@
 
 #include <algorithm>
 
+class ListHook;
+
+template <typename T, typename Hook = ListHook>
+class List;
+
 class ListHook {
 public:
     ListHook() = default;
@@ -27,9 +32,12 @@ public:
     ListHook(const ListHook&) = delete;
 
 private:
-    template <class T>
+    template <class T, class Hook>
     friend class List;
 
+    template <class T, class Key, class KeyOf, class Hash, class Hook>
+    friend class IntrusiveHashTable;
+
     ListHook* prev_ = this;
     ListHook* next_ = this;
     bool linked_ = false;
@@ -44,7 +52,13 @@ private:
     }
 };
 
-template <typename T>
+// Lets one object be linked into several lists at the same time:
+//   struct Entry : TaggedListHook<LruTag>, TaggedListHook<IndexTag> {};
+//   List<Entry, TaggedListHook<LruTag>> lru;
+template <class Tag>
+class TaggedListHook : public ListHook {};
+
+template <typename T, typename Hook>
 class List {
 public:
     class Iterator : public std::iterator<std::bidirectional_iterator_tag, T> {
@@ -62,10 +76,10 @@ public:
         }
 
         T& operator*() const {
-            return static_cast<T&>(*now_);
+            return Cast(now_);
         }
         T* operator->() const {
-            return static_cast<T*>(now_);
+            return &Cast(now_);
         }
 
         bool operator==(const Iterator& rhs) const {
@@ -122,24 +136,24 @@ public:
     // note that IntrusiveList doesn't own elements,
     // and never copies or moves T
     void PushBack(T* elem) {
-        elem->LinkBefore(start_);
+        ToHook(elem)->LinkBefore(start_);
     }
     void PushFront(T* elem) {
-        elem->LinkBefore(start_->next_);
+        ToHook(elem)->LinkBefore(start_->next_);
     }
 
     T& Front() {
-        return static_cast<T&>(*start_->next_);
+        return Cast(start_->next_);
     }
     const T& Front() const {
-        return static_cast<const T&>(*start_->next_);
+        return Cast(start_->next_);
     }
 
     T& Back() {
-        return static_cast<T&>(*start_->prev_);
+        return Cast(start_->prev_);
     }
     const T& Back() const {
-        return static_cast<const T&>(*start_->prev_);
+        return Cast(start_->prev_);
     }
 
     void PopBack() {
@@ -158,10 +172,17 @@ public:
 
     // complexity of this function must be O(1)
     Iterator IteratorTo(T* element) {
-        return Iterator(element);
+        return Iterator(ToHook(element));
     }
 
 private:
+    static ListHook* ToHook(T* elem) {
+        return static_cast<Hook*>(elem);
+    }
+    static T& Cast(ListHook* hook) {
+        return static_cast<T&>(static_cast<Hook&>(*hook));
+    }
+
     void UnlinkAll() {
         ListHook* now = start_->next_;
         while (now != start_) {
@@ -173,12 +194,12 @@ private:
     ListHook* start_;
 };
 
-template <typename T>
-typename List<T>::Iterator begin(List<T>& list) {  // NOLINT
+template <typename T, typename Hook>
+typename List<T, Hook>::Iterator begin(List<T, Hook>& list) {  // NOLINT
     return list.Begin();
 }
 
-template <typename T>
-typename List<T>::Iterator end(List<T>& list) {  // NOLINT
+template <typename T, typename Hook>
+typename List<T, Hook>::Iterator end(List<T, Hook>& list) {  // NOLINT
     return list.End();
 }
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "intrusive_hash.h"
+#include "intrusive_list.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+struct CacheRecencyTag {};
+struct CacheIndexTag {};
+
+enum class EvictionPolicy { kLru, kClock };
+
+template <class T, class Key, class Hash, EvictionPolicy Policy>
+class IntrusiveCache;
+
+// Cache entries derive from CacheEntry, so both the recency list and the
+// hash index are threaded through the entry itself.
+template <class Key>
+class CacheEntry : public TaggedListHook<CacheRecencyTag>, public TaggedListHook<CacheIndexTag> {
+public:
+    explicit CacheEntry(Key key) : key_(std::move(key)) {
+    }
+
+    const Key& GetKey() const {
+        return key_;
+    }
+
+private:
+    template <class T, class K, class Hash, EvictionPolicy Policy>
+    friend class IntrusiveCache;
+
+    Key key_;
+    bool referenced_ = false;
+};
+
+// IntrusiveCache never owns entries: Insert hands back the entry it pushed out
+// and the caller decides what to do with it. All operations are O(1) and
+// don't allocate.
+//
+// kLru moves an entry to the tail on every hit, kClock only sets a reference
+// bit and gives referenced entries a second chance on eviction.
+template <class T, class Key, class Hash = std::hash<Key>,
+          EvictionPolicy Policy = EvictionPolicy::kLru>
+class IntrusiveCache {
+public:
+    explicit IntrusiveCache(size_t capacity) : capacity_(capacity), index_(capacity) {
+    }
+
+    IntrusiveCache(const IntrusiveCache&) = delete;
+    IntrusiveCache& operator=(const IntrusiveCache&) = delete;
+
+    // Find returns the entry with the given key or nullptr, and marks it as recently used.
+    T* Find(const Key& key) {
+        T* elem = index_.Find(key);
+        if (elem) {
+            Touch(elem);
+        }
+        return elem;
+    }
+
+    // Insert links elem into the cache. Returns the old entry with the same key
+    // or the evicted one, nullptr if nothing was pushed out. Inserting an entry
+    // that is already cached just marks it as recently used.
+    T* Insert(T* elem) {
+        if (T* old = index_.Find(elem->GetKey())) {
+            if (old == elem) {
+                Touch(elem);
+                return nullptr;
+            }
+            Erase(old);
+            Link(elem);
+            return old;
+        }
+        if (capacity_ == 0) {
+            return elem;
+        }
+        T* evicted = nullptr;
+        if (index_.Size() == capacity_) {
+            evicted = Evict();
+        }
+        Link(elem);
+        return evicted;
+    }
+
+    // Must be called before linked entry is destroyed. Does nothing if elem
+    // was already evicted.
+    void Erase(T* elem) {
+        if (!static_cast<IndexHook*>(elem)->IsLinked()) {
+            return;
+        }
+        index_.Erase(elem);
+        static_cast<RecencyHook*>(elem)->Unlink();
+    }
+
+    size_t Size() const {
+        return index_.Size();
+    }
+
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+private:
+    using RecencyHook = TaggedListHook<CacheRecencyTag>;
+    using IndexHook = TaggedListHook<CacheIndexTag>;
+
+    void Link(T* elem) {
+        elem->referenced_ = false;
+        index_.Insert(elem);
+        order_.PushBack(elem);
+    }
+
+    void Touch(T* elem) {
+        if constexpr (Policy == EvictionPolicy::kLru) {
+            static_cast<RecencyHook*>(elem)->Unlink();
+            order_.PushBack(elem);
+        } else {
+            elem->referenced_ = true;
+        }
+    }
+
+    T* Evict() {
+        if constexpr (Policy == EvictionPolicy::kClock) {
+            while (order_.Front().referenced_) {
+                T* elem = &order_.Front();
+                elem->referenced_ = false;
+                order_.PopFront();
+                order_.PushBack(elem);
+            }
+        }
+        T* victim = &order_.Front();
+        Erase(victim);
+        return victim;
+    }
+
+    size_t capacity_;
+    IntrusiveHashMap<T, Key, Hash, IndexHook> index_;
+    List<T, RecencyHook> order_;
+};
+
+// ShardedCache splits keys between independently locked IntrusiveCache-s.
+//
+// Safe to call from multiple threads. Entries are only accessed under the
+// shard lock, so Find takes a callback instead of returning a pointer.
+template <class T, class Key, class Hash = std::hash<Key>,
+          EvictionPolicy Policy = EvictionPolicy::kLru>
+class ShardedCache {
+public:
+    ShardedCache(size_t capacity, size_t shard_count) {
+        assert(shard_count > 0);
+        size_t shard_capacity = (capacity + shard_count - 1) / shard_count;
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards_.push_back(std::make_unique<Shard>(shard_capacity));
+        }
+    }
+
+    template <class Func>
+    bool Find(const Key& key, Func func) {
+        Shard& shard = GetShard(key);
+        std::lock_guard lock(shard.mutex);
+        T* elem = shard.cache.Find(key);
+        if (!elem) {
+            return false;
+        }
+        func(*elem);
+        return true;
+    }
+
+    // Same contract as IntrusiveCache::Insert. Returned entry is already
+    // unlinked, so it can be destroyed without holding any lock.
+    T* Insert(T* elem) {
+        Shard& shard = GetShard(elem->GetKey());
+        std::lock_guard lock(shard.mutex);
+        return shard.cache.Insert(elem);
+    }
+
+    void Erase(T* elem) {
+        Shard& shard = GetShard(elem->GetKey());
+        std::lock_guard lock(shard.mutex);
+        shard.cache.Erase(elem);
+    }
+
+    size_t Size() {
+        size_t size = 0;
+        for (auto& shard : shards_) {
+            std::lock_guard lock(shard->mutex);
+            size += shard->cache.Size();
+        }
+        return size;
+    }
+
+private:
+    struct Shard {
+        explicit Shard(size_t capacity) : cache(capacity) {
+        }
+
+        std::mutex mutex;
+        IntrusiveCache<T, Key, Hash, Policy> cache;
+    };
+
+    // Shard is picked by the high bits of the mixed hash, bucket inside the
+    // shard uses the low bits, so the two don't correlate.
+    Shard& GetShard(const Key& key) {
+        uint64_t mixed = static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ull;
+        return *shards_[(mixed >> 32) % shards_.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    Hash hash_;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "intrusive_list.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+struct TimerTag {};
+
+template <class T>
+class TimerWheel;
+
+// Timers derive from TimerEntry. Arming, cancelling and expiring only relink
+// the embedded hook, so none of them allocate.
+class TimerEntry : public TaggedListHook<TimerTag> {
+public:
+    bool IsArmed() const {
+        return IsLinked();
+    }
+
+    // Safe to call on a timer that isn't armed
+    void Cancel() {
+        Unlink();
+    }
+
+    uint64_t GetDeadline() const {
+        return deadline_;
+    }
+
+private:
+    template <class T>
+    friend class TimerWheel;
+
+    uint64_t deadline_ = 0;
+};
+
+// Hashed hierarchical timer wheel: kLevels wheels of kSlots slots, level l
+// slot covers kSlots^l ticks. Timer is put on the lowest level whose range
+// covers its deadline and moves one level down each time its slot comes up,
+// so every timer is relinked at most kLevels times. Deadlines further than
+// kSlots^kLevels ticks are parked on the top level and rescheduled.
+template <class T>
+class TimerWheel {
+public:
+    static constexpr size_t kLevels = 4;
+    static constexpr size_t kSlotBits = 8;
+    static constexpr size_t kSlots = size_t{1} << kSlotBits;
+
+    explicit TimerWheel(uint64_t now = 0) : now_(now) {
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    uint64_t Now() const {
+        return now_;
+    }
+
+    // Timer fires on the first Advance that reaches deadline, deadlines in the
+    // past fire on the next tick. Rearms the timer if it is already armed.
+    void Schedule(T* timer, uint64_t deadline) {
+        TimerEntry* entry = timer;
+        entry->Cancel();
+        entry->deadline_ = std::max(deadline, now_ + 1);
+        Place(timer);
+    }
+
+    void ScheduleAfter(T* timer, uint64_t ticks) {
+        Schedule(timer, now_ + ticks);
+    }
+
+    // Moves time forward to `target` and calls func(T&) for every expired
+    // timer. Timer is already unlinked when func is called, so func may
+    // rearm or destroy it.
+    template <class Func>
+    void AdvanceTo(uint64_t target, Func func) {
+        while (now_ < target) {
+            SkipEmptySlots(target);
+            Tick(func);
+        }
+    }
+
+    template <class Func>
+    void Advance(uint64_t ticks, Func func) {
+        AdvanceTo(now_ + ticks, func);
+    }
+
+private:
+    using Hook = TaggedListHook<TimerTag>;
+    using Slot = List<T, Hook>;
+
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+    static constexpr uint64_t kMaxDelta = (uint64_t{1} << (kSlotBits * kLevels)) - 1;
+
+    // Deadline may equal now_ only while cascading, then timer goes to the
+    // level 0 slot which is expired right after.
+    void Place(T* timer) {
+        uint64_t deadline = static_cast<TimerEntry*>(timer)->deadline_;
+        uint64_t delta = deadline - now_;
+        if (delta > kMaxDelta) {
+            deadline = now_ + kMaxDelta;
+            delta = kMaxDelta;
+        }
+        size_t level = 0;
+        while (delta >> (kSlotBits * (level + 1))) {
+            ++level;
+        }
+        size_t index = (deadline >> (kSlotBits * level)) & kSlotMask;
+        wheels_[level][index].PushBack(timer);
+        if (level == 0) {
+            occupied_[index / 64] |= uint64_t{1} << (index % 64);
+        }
+    }
+
+    template <class Func>
+    void Tick(Func& func) {
+        ++now_;
+        size_t index = now_ & kSlotMask;
+        if (index == 0) {
+            Cascade();
+        }
+        Slot& slot = wheels_[0][index];
+        while (!slot.IsEmpty()) {
+            T* timer = &slot.Front();
+            slot.PopFront();
+            func(*timer);
+        }
+        occupied_[index / 64] &= ~(uint64_t{1} << (index % 64));
+    }
+
+    void Cascade() {
+        for (size_t level = 1; level < kLevels; ++level) {
+            size_t index = (now_ >> (kSlotBits * level)) & kSlotMask;
+            Slot& slot = wheels_[level][index];
+            while (!slot.IsEmpty()) {
+                T* timer = &slot.Front();
+                slot.PopFront();
+                Place(timer);
+            }
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+
+    // Jumps over level 0 slots that have nothing to expire, stopping before
+    // the next cascade. Bits in occupied_ may be stale after Cancel, which only
+    // makes the skip shorter.
+    void SkipEmptySlots(uint64_t target) {
+        size_t from = (now_ & kSlotMask) + 1;
+        size_t next = kSlots;
+        for (size_t word = from / 64; word < kSlots / 64; ++word) {
+            uint64_t bits = occupied_[word];
+            if (word == from / 64) {
+                bits &= ~uint64_t{0} << (from % 64);
+            }
+            if (bits) {
+                next = word * 64 + std::countr_zero(bits);
+                break;
+            }
+        }
+        uint64_t last_empty = (now_ & ~kSlotMask) + next - 1;
+        now_ = std::max(now_, std::min(last_empty, target - 1));
+    }
+
+    uint64_t now_;
+    std::array<std::array<Slot, kSlots>, kLevels> wheels_;
+    std::array<uint64_t, kSlots / 64> occupied_{};
+};
+
+// TimerWheel driven by a monotonic clock, one tick is `tick` of clock time.
+template <class T, class Clock = std::chrono::steady_clock>
+class ClockTimerWheel {
+public:
+    explicit ClockTimerWheel(typename Clock::duration tick = std::chrono::milliseconds(1))
+        : tick_(tick), start_(Clock::now()) {
+    }
+
+    void ScheduleAfter(T* timer, typename Clock::duration timeout) {
+        wheel_.Schedule(timer, ToTick(Clock::now() + timeout + tick_ - typename Clock::duration(1)));
+    }
+
+    void ScheduleAt(T* timer, typename Clock::time_point deadline) {
+        wheel_.Schedule(timer, ToTick(deadline + tick_ - typename Clock::duration(1)));
+    }
+
+    // Expires all timers whose deadline has passed
+    template <class Func>
+    void Poll(Func func) {
+        wheel_.AdvanceTo(ToTick(Clock::now()), func);
+    }
+
+private:
+    uint64_t ToTick(typename Clock::time_point time) const {
+        if (time <= start_) {
+            return 0;
+        }
+        return static_cast<uint64_t>((time - start_) / tick_);
+    }
+
+    typename Clock::duration tick_;
+    typename Clock::time_point start_;
+    TimerWheel<T> wheel_;
+};
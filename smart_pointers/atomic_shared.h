@@ -0,0 +1,147 @@
+#pragma once
+
+#include "shared.h"
+#include "../threads/hazard_pointer.h"
+
+#include <atomic>
+#include <utility>
+
+// Atomic cell holding a SharedPtr, for RCU-style publication of read-mostly
+// state. The cell points to an immutable node with the current SharedPtr;
+// writers swap in a new node and retire the old one through hazard pointers,
+// readers protect the node for as long as they look at it. All operations
+// are lock-free.
+//
+// Load copies the SharedPtr and so bumps the shared reference count, which
+// every reader of the same object contends on. Read doesn't touch the count
+// at all: it returns a guard that keeps the current object alive until the
+// guard dies, so hot read paths should prefer it.
+template <typename T>
+class AtomicSharedPtr {
+    struct Node;
+
+public:
+    using Pointer = SharedPtr<T, AtomicRefCount>;
+
+    // Pins one snapshot of the cell
+    class ReadGuard {
+    public:
+        T *Get() const {
+            return node_ ? node_->value.Get() : nullptr;
+        }
+
+        T &operator*() const {
+            return *Get();
+        }
+
+        T *operator->() const {
+            return Get();
+        }
+
+        explicit operator bool() const {
+            return Get();
+        }
+
+    private:
+        friend class AtomicSharedPtr;
+
+        explicit ReadGuard(const std::atomic<Node *> &cell) : node_(hazard_.Protect(cell)) {
+        }
+
+        HazardPointer hazard_;
+        Node *node_;
+    };
+
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(Pointer desired) : node_(MakeNode(std::move(desired))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr &) = delete;
+    AtomicSharedPtr &operator=(const AtomicSharedPtr &) = delete;
+
+    // Not safe to call concurrently with other methods
+    ~AtomicSharedPtr() {
+        delete node_.load(std::memory_order_relaxed);
+    }
+
+    Pointer Load() const {
+        HazardPointer hazard;
+        Node *node = hazard.Protect(node_);
+        return node ? node->value : Pointer();
+    }
+
+    ReadGuard Read() const {
+        return ReadGuard(node_);
+    }
+
+    void Store(Pointer desired) {
+        Retire(node_.exchange(MakeNode(std::move(desired)), std::memory_order_acq_rel));
+    }
+
+    Pointer Exchange(Pointer desired) {
+        Node *old = node_.exchange(MakeNode(std::move(desired)), std::memory_order_acq_rel);
+        // concurrent Loads may still copy old->value, so copy it too instead
+        // of moving out
+        Pointer result = old ? old->value : Pointer();
+        Retire(old);
+        return result;
+    }
+
+    // Replaces the value with desired if it owns the same object and points
+    // to the same address as expected. Otherwise loads current value into
+    // expected and returns false.
+    //
+    // The node for desired is made only once a CAS is due and is reused if
+    // the CAS fails, so a mismatch costs no allocation.
+    bool CompareExchange(Pointer &expected, Pointer desired) {
+        HazardPointer hazard;
+        Node *replacement = nullptr;
+        bool made = false;
+        while (true) {
+            Node *node = hazard.Protect(node_);
+            if (!Equivalent(node, expected)) {
+                expected = node ? node->value : Pointer();
+                delete replacement;
+                return false;
+            }
+            if (!made) {
+                replacement = MakeNode(std::move(desired));
+                made = true;
+            }
+            if (node_.compare_exchange_strong(node, replacement, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed)) {
+                Retire(node);
+                return true;
+            }
+        }
+    }
+
+private:
+    struct Node {
+        Pointer value;
+    };
+
+    // Empty pointers are stored as no node at all
+    static Node *MakeNode(Pointer value) {
+        if (!value.base_ && !value.ptr_) {
+            return nullptr;
+        }
+        return new Node{std::move(value)};
+    }
+
+    static void Retire(Node *node) {
+        if (node) {
+            RetireHazard(node);
+        }
+    }
+
+    static bool Equivalent(const Node *node, const Pointer &expected) {
+        if (!node) {
+            return !expected.base_ && !expected.ptr_;
+        }
+        return node->value.base_ == expected.base_ && node->value.ptr_ == expected.ptr_;
+    }
+
+    std::atomic<Node *> node_ = nullptr;
+};
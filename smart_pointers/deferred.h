@@ -0,0 +1,189 @@
+#pragma once
+
+#include "shared.h"
+#include "../threads/mpsc_queue.h"
+#include "../threads/node_pool.h"
+#include "../threads/parking_lot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Moves destruction of retired objects off the thread that drops the last
+// reference. Retire is a wait-free push to an intrusive MPSC queue. Objects
+// are destroyed in batches, either by a background thread or by whoever
+// calls Drain at a safe point, e.g. between requests. PendingBytes tells how
+// much memory is waiting, so callers can drain or back off if it grows.
+class DeferredReclaimer {
+public:
+    // With background = true a thread of its own destroys retired objects
+    // as soon as they arrive; otherwise only Drain does
+    explicit DeferredReclaimer(bool background = false) {
+        if (background) {
+            thread_ = std::thread([this] { BackgroundLoop(); });
+        }
+    }
+
+    DeferredReclaimer(const DeferredReclaimer &) = delete;
+    DeferredReclaimer &operator=(const DeferredReclaimer &) = delete;
+
+    // Stops background thread and destroys everything still pending
+    ~DeferredReclaimer() {
+        if (thread_.joinable()) {
+            stopped_.store(true, std::memory_order_relaxed);
+            parking_lot::UnparkAll(&pending_count_);
+            thread_.join();
+        }
+        while (PendingCount() != 0) {
+            Drain();
+        }
+    }
+
+    // Retire queues ptr to be freed with deleter, bytes is what it will give
+    // back (the whole object graph, if known).
+    //
+    // Safe to call from multiple threads.
+    void Retire(void *ptr, void (*deleter)(void *), size_t bytes) {
+        Node *node = new (NodePool<Node>::Allocate()) Node(ptr, deleter, bytes);
+        // counted before the push, so a drain that pops the node right away
+        // never takes the counters below zero
+        pending_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        bool was_empty = pending_count_.fetch_add(1, std::memory_order_seq_cst) == 0;
+        queue_.Push(node);
+        if (was_empty && thread_.joinable()) {
+            parking_lot::UnparkOne(&pending_count_);
+        }
+    }
+
+    template <typename T>
+    void Retire(T *ptr, size_t bytes = sizeof(T)) {
+        Retire(ptr, [](void *p) { delete static_cast<T *>(p); }, bytes);
+    }
+
+    // Drain destroys up to max retired objects in batches and returns how
+    // many it has destroyed. Returns 0 at once if another thread is draining.
+    //
+    // Safe to call from multiple threads.
+    size_t Drain(size_t max = std::numeric_limits<size_t>::max()) {
+        std::unique_lock<ParkingMutex> lock(consumer_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return 0;
+        }
+        size_t drained = 0;
+        while (drained < max) {
+            size_t batch = DrainBatch(std::min(max - drained, kBatchSize));
+            if (batch == 0) {
+                break;
+            }
+            drained += batch;
+        }
+        lock.unlock();
+        // leftovers (past max, or retired by the deleters themselves) are
+        // the background thread's, which may be parked
+        if (PendingCount() != 0 && thread_.joinable()) {
+            parking_lot::UnparkOne(&pending_count_);
+        }
+        return drained;
+    }
+
+    size_t PendingBytes() const {
+        return pending_bytes_.load(std::memory_order_relaxed);
+    }
+
+    size_t PendingCount() const {
+        return pending_count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t kBatchSize = 64;
+
+    struct Node : MPSCQueueHook {
+        Node(void *ptr, void (*deleter)(void *), size_t bytes) : ptr(ptr), deleter(deleter), bytes(bytes) {
+        }
+
+        void *ptr;
+        void (*deleter)(void *);
+        size_t bytes;
+    };
+
+    // Caller holds consumer_. Counters drop once per batch, not per object.
+    size_t DrainBatch(size_t max) {
+        size_t count = 0;
+        size_t bytes = 0;
+        while (count < max) {
+            Node *node = queue_.Pop();
+            if (!node) {
+                break;
+            }
+            node->deleter(node->ptr);
+            bytes += node->bytes;
+            ++count;
+            node->~Node();
+            NodePool<Node>::Deallocate(node);
+        }
+        pending_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+        pending_count_.fetch_sub(count, std::memory_order_seq_cst);
+        return count;
+    }
+
+    void BackgroundLoop() {
+        while (!stopped_.load(std::memory_order_relaxed)) {
+            if (PendingCount() != 0) {
+                // Pop may miss a half-done Push, then just try again
+                if (Drain() == 0) {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            parking_lot::Park(&pending_count_, [&] {
+                return pending_count_.load(std::memory_order_relaxed) == 0 &&
+                       !stopped_.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    MPSCQueue<Node> queue_;
+    ParkingMutex consumer_;
+    alignas(64) std::atomic<size_t> pending_count_ = 0;
+    std::atomic<size_t> pending_bytes_ = 0;
+    std::atomic<bool> stopped_ = false;
+    std::thread thread_;
+};
+
+// Process-wide reclaimer with a background thread
+inline DeferredReclaimer &DefaultReclaimer() {
+    static DeferredReclaimer reclaimer(true);
+    return reclaimer;
+}
+
+// SharedPtr deleter that retires the object instead of deleting it inline:
+//
+//     SharedPtr<Graph> graph(new Graph, DeferredDelete<Graph>(reclaimer, bytes));
+template <typename T>
+class DeferredDelete {
+public:
+    explicit DeferredDelete(DeferredReclaimer &reclaimer = DefaultReclaimer(), size_t bytes = sizeof(T))
+        : reclaimer_(&reclaimer), bytes_(bytes) {
+    }
+
+    void operator()(T *ptr) const {
+        reclaimer_->Retire(ptr, bytes_);
+    }
+
+private:
+    DeferredReclaimer *reclaimer_;
+    size_t bytes_;
+};
+
+// MakeShared counterpart whose final release is deferred to the default
+// reclaimer. Object and control block are two allocations here: the object
+// has to outlive the block it would otherwise share memory with.
+template <typename T, typename Policy = NonAtomicRefCount, typename... Args>
+SharedPtr<T, Policy> MakeDeferredShared(Args &&...args) {
+    return SharedPtr<T, Policy>(new T(std::forward<Args>(args)...), DeferredDelete<T>());
+}
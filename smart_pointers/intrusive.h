@@ -0,0 +1,184 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <utility>
+
+// Base for objects owned through IntrusivePtr: the reference count lives in
+// the object itself. Policy is NonAtomicRefCount or AtomicRefCount from
+// ref_count.h. The last ReleaseRef deletes the object as T, so T or its
+// bases must have a virtual destructor if it is owned through a base.
+template <typename T, typename Policy = NonAtomicRefCount>
+class RefCounted {
+public:
+    void AddRef() const {
+        Policy::Increment(ref_count_);
+    }
+
+    void ReleaseRef() const {
+        if (Policy::Decrement(ref_count_)) {
+            delete static_cast<const T *>(this);
+        }
+    }
+
+    size_t RefCount() const {
+        return Policy::Load(ref_count_);
+    }
+
+protected:
+    RefCounted() = default;
+
+    // A copy is a new object with no owners yet
+    RefCounted(const RefCounted &) {
+    }
+
+    RefCounted &operator=(const RefCounted &) {
+        return *this;
+    }
+
+    ~RefCounted() = default;
+
+private:
+    mutable typename Policy::Counter ref_count_ = 0;
+};
+
+// Tag for taking over a reference the caller already owns
+struct AdoptRef {};
+
+// One-word owning pointer to an object with AddRef() and ReleaseRef(),
+// usually a RefCounted. Since the count is in the object, a raw pointer
+// converts back to an owning one at any time, e.g. IntrusivePtr<T>(this)
+// inside a member function, without a control block or weak self-reference.
+template <typename T>
+class IntrusivePtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusivePtr() = default;
+
+    IntrusivePtr(std::nullptr_t) {
+    }
+
+    explicit IntrusivePtr(T *ptr) : ptr_(ptr) {
+        AddRef();
+    }
+
+    IntrusivePtr(T *ptr, AdoptRef) : ptr_(ptr) {
+    }
+
+    IntrusivePtr(const IntrusivePtr &other) : ptr_(other.ptr_) {
+        AddRef();
+    }
+
+    template <typename U>
+    IntrusivePtr(const IntrusivePtr<U> &other) : ptr_(other.Get()) {
+        AddRef();
+    }
+
+    IntrusivePtr(IntrusivePtr &&other) : ptr_(std::exchange(other.ptr_, nullptr)) {
+    }
+
+    template <typename U>
+    IntrusivePtr(IntrusivePtr<U> &&other) : ptr_(other.Detach()) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    IntrusivePtr &operator=(const IntrusivePtr &other) {
+        IntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr &operator=(IntrusivePtr &&other) {
+        IntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusivePtr() {
+        Release();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        IntrusivePtr().Swap(*this);
+    }
+
+    void Reset(T *ptr) {
+        IntrusivePtr(ptr).Swap(*this);
+    }
+
+    // Gives up ownership without releasing the reference
+    T *Detach() {
+        return std::exchange(ptr_, nullptr);
+    }
+
+    void Swap(IntrusivePtr &other) {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T *Get() const {
+        return ptr_;
+    }
+
+    T &operator*() const {
+        return *Get();
+    }
+
+    T *operator->() const {
+        return Get();
+    }
+
+    explicit operator bool() const {
+        return ptr_;
+    }
+
+private:
+    void AddRef() {
+        if (ptr_) {
+            ptr_->AddRef();
+        }
+    }
+
+    void Release() {
+        if (ptr_) {
+            // releasing may destroy the object holding this pointer
+            std::exchange(ptr_, nullptr)->ReleaseRef();
+        }
+    }
+
+    T *ptr_ = nullptr;
+};
+
+template <typename T, typename U>
+inline bool operator==(const IntrusivePtr<T> &left, const IntrusivePtr<U> &right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args &&...args) {
+    return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+// SharedPtr that holds one intrusive reference, for passing an intrusively
+// counted object to code built on SharedPtr. If T also derives from
+// EnableSharedFromThis, SharedFromThis shares ownership with the first
+// ToShared pointer still alive; once all of them are gone it throws like on
+// any object without a shared owner, even if IntrusivePtrs keep it alive.
+template <typename Policy = NonAtomicRefCount, typename T>
+SharedPtr<T, Policy> ToShared(IntrusivePtr<T> ptr) {
+    if (!ptr) {
+        return SharedPtr<T, Policy>();
+    }
+    return SharedPtr<T, Policy>(ptr.Detach(), [](T *raw) { raw->ReleaseRef(); });
+}
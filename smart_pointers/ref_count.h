@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Reference counting policies for SharedPtr and WeakPtr. A policy defines
+// the counter type and how to change it; NonAtomicRefCount compiles to plain
+// increments for pointers that never leave their thread, AtomicRefCount lets
+// copies live in different threads.
+
+struct NonAtomicRefCount {
+    using Counter = size_t;
+
+    static void Increment(Counter &count) {
+        ++count;
+    }
+
+    static bool IncrementIfNonZero(Counter &count) {
+        if (count == 0) {
+            return false;
+        }
+        ++count;
+        return true;
+    }
+
+    // Returns true if it was the last reference
+    static bool Decrement(Counter &count) {
+        return --count == 0;
+    }
+
+    static size_t Load(const Counter &count) {
+        return count;
+    }
+};
+
+struct AtomicRefCount {
+    using Counter = std::atomic<size_t>;
+
+    // New reference is always copied from an existing one, which keeps the
+    // object alive, so nothing has to be ordered here
+    static void Increment(Counter &count) {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static bool IncrementIfNonZero(Counter &count) {
+        size_t value = count.load(std::memory_order_relaxed);
+        do {
+            if (value == 0) {
+                return false;
+            }
+        } while (!count.compare_exchange_weak(value, value + 1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed));
+        return true;
+    }
+
+    // Release publishes writes made through this reference, acquire on the
+    // last one makes all of them visible to the destructor
+    static bool Decrement(Counter &count) {
+        return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    static size_t Load(const Counter &count) {
+        return count.load(std::memory_order_relaxed);
+    }
+};
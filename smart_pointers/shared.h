@@ -1,58 +1,308 @@
 #pragma once
 
 #include "sw_fwd.h"  // Forward declaration
+#include "ref_count.h"
+#include "../threads/node_pool.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <new>
 #include <type_traits>
 #include <utility>
 #include <cstddef>  // std::nullptr_t
 
+// Control blocks up to kMaxPooledBlockSize bytes come from a pool of their
+// own type with per-thread free lists, so making and dropping SharedPtrs
+// doesn't reach the global heap in steady state. Bigger blocks are rare and
+// not worth keeping around.
+namespace control_block_detail {
+
+inline constexpr size_t kMaxPooledBlockSize = 256;
+
+template <typename Block>
+void *Allocate() {
+    if constexpr (sizeof(Block) <= kMaxPooledBlockSize) {
+        return NodePool<Block>::Allocate();
+    } else {
+        return ::operator new(sizeof(Block), std::align_val_t(alignof(Block)));
+    }
+}
+
+template <typename Block>
+void Deallocate(void *ptr) {
+    if constexpr (sizeof(Block) <= kMaxPooledBlockSize) {
+        NodePool<Block>::Deallocate(ptr);
+    } else {
+        ::operator delete(ptr, std::align_val_t(alignof(Block)));
+    }
+}
+
+}  // namespace control_block_detail
+
+// Control blocks have no vtable: the base keeps one pointer to a manager
+// function of the concrete block, which destroys the object or frees the
+// block. That is a single indirect call on the last release, and the block
+// needs no virtual destructor.
+//
+// Shared owners hold one weak reference between them, so the block outlives
+// the object even if the last weak reference goes away while the object is
+// being destroyed.
+template <typename Policy>
 class ControlBlockBase {
 public:
-    size_t shared_ref_count = 0;
-    size_t weak_ref_count = 0;
-    virtual ~ControlBlockBase() = default;
-};
+    enum class Action { kDestroyObject, kDeleteBlock };
+    using Manager = void (*)(ControlBlockBase *, Action);
 
-template <typename T>
-class ControlBlockPointer : public ControlBlockBase {
-public:
-    ControlBlockPointer(T *ptr) : ptr_(ptr) {
+    typename Policy::Counter shared_ref_count = 0;
+    typename Policy::Counter weak_ref_count = 1;
+
+    explicit ControlBlockBase(Manager manager) : manager_(manager) {
     }
 
-    ~ControlBlockPointer() override {
-        if (shared_ref_count == 0) {
-            delete ptr_;
+    ControlBlockBase(const ControlBlockBase &) = delete;
+    ControlBlockBase &operator=(const ControlBlockBase &) = delete;
+
+    void AddShared() {
+        Policy::Increment(shared_ref_count);
+    }
+
+    bool TryAddShared() {
+        return Policy::IncrementIfNonZero(shared_ref_count);
+    }
+
+    void ReleaseShared() {
+        if (Policy::Decrement(shared_ref_count)) {
+            manager_(this, Action::kDestroyObject);
+            ReleaseWeak();
+        }
+    }
+
+    void AddWeak() {
+        Policy::Increment(weak_ref_count);
+    }
+
+    void ReleaseWeak() {
+        if (Policy::Decrement(weak_ref_count)) {
+            manager_(this, Action::kDeleteBlock);
+        }
+    }
+
+    size_t UseCount() const {
+        return Policy::Load(shared_ref_count);
+    }
+
+protected:
+    // Manager of a Block with DestroyObject() and static Delete(Block *)
+    template <typename Block>
+    static void Manage(ControlBlockBase *base, Action action) {
+        Block *block = static_cast<Block *>(base);
+        if (action == Action::kDestroyObject) {
+            block->DestroyObject();
+        } else {
+            Block::Delete(block);
         }
     }
 
 private:
+    Manager manager_;
+};
+
+// Owns a pointer and the deleter for it, stateless deleters take no space
+template <typename T, typename Deleter, typename Policy>
+class ControlBlockPointer : public ControlBlockBase<Policy> {
+public:
+    // Deletes ptr if the block can't be allocated
+    static ControlBlockPointer *Create(T *ptr, Deleter deleter) {
+        void *memory;
+        try {
+            memory = control_block_detail::Allocate<ControlBlockPointer>();
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        return new (memory) ControlBlockPointer(ptr, std::move(deleter));
+    }
+
+private:
+    friend class ControlBlockBase<Policy>;
+
+    ControlBlockPointer(T *ptr, Deleter deleter)
+        : ControlBlockBase<Policy>(&ControlBlockBase<Policy>::template Manage<ControlBlockPointer>),
+          ptr_(ptr),
+          deleter_(std::move(deleter)) {
+    }
+
+    void DestroyObject() {
+        deleter_(ptr_);
+    }
+
+    static void Delete(ControlBlockPointer *block) {
+        block->~ControlBlockPointer();
+        control_block_detail::Deallocate<ControlBlockPointer>(block);
+    }
+
     T *ptr_ = nullptr;
+    [[no_unique_address]] Deleter deleter_;
 };
 
-template <typename T>
-class ControlBlockHolder : public ControlBlockBase {
+template <typename T, typename Policy>
+class ControlBlockHolder : public ControlBlockBase<Policy> {
 public:
     template <typename... Args>
-    ControlBlockHolder(Args &&...args) {
+    static ControlBlockHolder *Create(Args &&...args) {
+        void *memory = control_block_detail::Allocate<ControlBlockHolder>();
+        try {
+            return new (memory) ControlBlockHolder(std::forward<Args>(args)...);
+        } catch (...) {
+            control_block_detail::Deallocate<ControlBlockHolder>(memory);
+            throw;
+        }
+    }
+
+    T *Get() {
+        return reinterpret_cast<T *>(&storage_);
+    }
+
+private:
+    friend class ControlBlockBase<Policy>;
+
+    template <typename... Args>
+    ControlBlockHolder(Args &&...args)
+        : ControlBlockBase<Policy>(&ControlBlockBase<Policy>::template Manage<ControlBlockHolder>) {
         new (&storage_) T(std::forward<Args>(args)...);
     }
 
+    void DestroyObject() {
+        Get()->~T();
+    }
+
+    static void Delete(ControlBlockHolder *block) {
+        block->~ControlBlockHolder();
+        control_block_detail::Deallocate<ControlBlockHolder>(block);
+    }
+
+    alignas(T) unsigned char storage_[sizeof(T)];
+};
+
+// Holder whose memory comes from a user allocator, see AllocateShared
+template <typename T, typename Alloc, typename Policy>
+class ControlBlockAllocated : public ControlBlockBase<Policy> {
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAllocated>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ValueAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+    using ValueTraits = std::allocator_traits<ValueAlloc>;
+
+public:
+    template <typename... Args>
+    static ControlBlockAllocated *Create(const Alloc &alloc, Args &&...args) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockAllocated *block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            ::new (static_cast<void *>(block)) ControlBlockAllocated(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
     T *Get() {
         return reinterpret_cast<T *>(&storage_);
     }
 
-    ~ControlBlockHolder() override {
-        if (shared_ref_count == 0) {
-            reinterpret_cast<T *>(&storage_)->~T();
+private:
+    friend class ControlBlockBase<Policy>;
+
+    template <typename... Args>
+    ControlBlockAllocated(const BlockAlloc &alloc, Args &&...args)
+        : ControlBlockBase<Policy>(&ControlBlockBase<Policy>::template Manage<ControlBlockAllocated>),
+          alloc_(alloc) {
+        ValueAlloc value_alloc(alloc_);
+        ValueTraits::construct(value_alloc, Get(), std::forward<Args>(args)...);
+    }
+
+    void DestroyObject() {
+        ValueAlloc value_alloc(alloc_);
+        ValueTraits::destroy(value_alloc, Get());
+    }
+
+    static void Delete(ControlBlockAllocated *block) {
+        BlockAlloc alloc(std::move(block->alloc_));
+        block->~ControlBlockAllocated();
+        BlockTraits::deallocate(alloc, block, 1);
+    }
+
+    [[no_unique_address]] BlockAlloc alloc_;
+    alignas(T) unsigned char storage_[sizeof(T)];
+};
+
+// Array of n value-initialized elements placed right after the block, see
+// MakeShared<T[]>
+template <typename T, typename Policy>
+class ControlBlockArray : public ControlBlockBase<Policy> {
+public:
+    static ControlBlockArray *Create(size_t size, const T *value) {
+        if (size > (std::numeric_limits<size_t>::max() - ElementsOffset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void *memory = ::operator new(ElementsOffset() + size * sizeof(T), std::align_val_t(kAlign));
+        auto *block = new (memory) ControlBlockArray(size);
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                if (value) {
+                    new (block->Get() + constructed) T(*value);
+                } else {
+                    new (block->Get() + constructed) T();
+                }
+            }
+        } catch (...) {
+            block->size_ = constructed;
+            block->DestroyObject();
+            ::operator delete(memory, std::align_val_t(kAlign));
+            throw;
         }
+        return block;
+    }
+
+    T *Get() {
+        return reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(this) + ElementsOffset());
     }
 
 private:
-    typename std::aligned_storage_t<sizeof(T), alignof(T)>::type storage_;
+    friend class ControlBlockBase<Policy>;
+
+    static constexpr size_t kAlign = std::max(alignof(T), alignof(ControlBlockBase<Policy>));
+
+    static constexpr size_t ElementsOffset() {
+        return (sizeof(ControlBlockArray) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    explicit ControlBlockArray(size_t size)
+        : ControlBlockBase<Policy>(&ControlBlockBase<Policy>::template Manage<ControlBlockArray>), size_(size) {
+    }
+
+    // Destroys elements in reverse order of construction
+    void DestroyObject() {
+        for (size_t i = size_; i > 0; --i) {
+            Get()[i - 1].~T();
+        }
+    }
+
+    static void Delete(ControlBlockArray *block) {
+        block->~ControlBlockArray();
+        ::operator delete(static_cast<void *>(block), std::align_val_t(kAlign));
+    }
+
+    size_t size_;
 };
 
-template <typename T>
+// SharedPtr<T[]> owns an array and has operator[] instead of * and ->
+template <typename T, typename Policy>
 class SharedPtr {
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -62,7 +312,13 @@ public:
     }
 
     template <typename U>
-    explicit SharedPtr(U *ptr) : ptr_(ptr), base_(new ControlBlockPointer<U>(ptr)) {
+    explicit SharedPtr(U *ptr) : SharedPtr(ptr, DefaultDelete<U>()) {
+    }
+
+    // Deleter is kept in the control block, no extra allocation
+    template <typename U, typename Deleter>
+    SharedPtr(U *ptr, Deleter deleter)
+        : ptr_(ptr), base_(ControlBlockPointer<U, Deleter, Policy>::Create(ptr, std::move(deleter))) {
         IncrementRefCount();
         if constexpr (std::is_convertible_v<U *, EnableSharedFromThisBase *>) {
             AddReferenceToSelf(ptr);
@@ -71,7 +327,7 @@ public:
     }
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y> &other) : ptr_(other.ptr_), base_(other.base_) {
+    SharedPtr(const SharedPtr<Y, Policy> &other) : ptr_(other.ptr_), base_(other.base_) {
         IncrementRefCount();
     }
 
@@ -80,7 +336,7 @@ public:
     }
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y> &&other) : ptr_(other.ptr_), base_(other.base_) {
+    SharedPtr(SharedPtr<Y, Policy> &&other) : ptr_(other.ptr_), base_(other.base_) {
         other.ptr_ = nullptr;
         other.base_ = nullptr;
     }
@@ -93,17 +349,18 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y> &other, T *ptr) : ptr_(ptr), base_(other.base_) {
+    SharedPtr(const SharedPtr<Y, Policy> &other, ElementType *ptr) : ptr_(ptr), base_(other.base_) {
         IncrementRefCount();
     }
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T> &other) : ptr_(other.ptr_), base_(other.base_) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T, Policy> &other) {
+        if (!other.base_ || !other.base_->TryAddShared()) {
             throw BadWeakPtr();
         }
-        IncrementRefCount();
+        ptr_ = other.ptr_;
+        base_ = other.base_;
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -150,10 +407,12 @@ public:
 
     template <typename U>
     void Reset(U *ptr) {
-        Unlink();
-        ptr_ = ptr;
-        base_ = new ControlBlockPointer<U>(ptr);
-        IncrementRefCount();
+        Reset(ptr, DefaultDelete<U>());
+    }
+
+    template <typename U, typename Deleter>
+    void Reset(U *ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
     }
 
     void Swap(SharedPtr &other) {
@@ -164,20 +423,30 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T *Get() const {
+    ElementType *Get() const {
         return ptr_;
     }
 
-    T &operator*() const {
+    T &operator*() const
+        requires(!std::is_array_v<T>)
+    {
         return *Get();
     }
 
-    T *operator->() const {
+    T *operator->() const
+        requires(!std::is_array_v<T>)
+    {
         return Get();
     }
 
+    ElementType &operator[](ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return Get()[index];
+    }
+
     size_t UseCount() const {
-        return base_ ? base_->shared_ref_count : static_cast<size_t>(0);
+        return base_ ? base_->UseCount() : static_cast<size_t>(0);
     }
 
     explicit operator bool() const {
@@ -185,56 +454,98 @@ public:
     }
 
 private:
-    T *ptr_ = nullptr;
-    ControlBlockBase *base_ = nullptr;
+    template <typename U>
+    using DefaultDelete = std::conditional_t<std::is_array_v<T>, std::default_delete<T>, std::default_delete<U>>;
+
+    ElementType *ptr_ = nullptr;
+    ControlBlockBase<Policy> *base_ = nullptr;
 
 private:
     void Unlink() {
         if (!base_) {
             return;
         }
-        --base_->shared_ref_count;
-        if (base_->shared_ref_count == 0 && base_->weak_ref_count == 0) {
-            delete base_;
-        } else if (base_->shared_ref_count == 0) {
-            ptr_->~T();
-        }
-        base_ = nullptr;
+        // releasing may destroy the object holding this pointer
+        ControlBlockBase<Policy> *base = std::exchange(base_, nullptr);
         ptr_ = nullptr;
+        base->ReleaseShared();
     }
 
     void IncrementRefCount() {
         if (base_) {
-            ++base_->shared_ref_count;
+            base_->AddShared();
         }
     }
 
     template <typename U>
-    void AddReferenceToSelf(EnableSharedFromThis<U> *ptr) {
-        ptr->self_ = *this;
+    void AddReferenceToSelf(EnableSharedFromThis<U, Policy> *ptr) {
+        // as std does, a live owner keeps its claim on the object
+        if (ptr->self_.Expired()) {
+            ptr->self_ = *this;
+        }
     }
 
-    template <typename U, typename... Args>
-    friend SharedPtr<U> MakeShared(Args &&...args);
+    template <typename U, typename P, typename... Args>
+    friend SharedPtr<U, P> MakeShared(Args &&...args);
 
-    template <typename U>
+    template <typename U, typename P, typename A, typename... Args>
+    friend SharedPtr<U, P> AllocateShared(const A &alloc, Args &&...args);
+
+    template <typename U, typename P>
     friend class SharedPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
+
+    template <typename U>
+    friend class AtomicSharedPtr;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T> &left, const SharedPtr<U> &right) {
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy> &left, const SharedPtr<U, Policy> &right) {
     return left.Get() == right.Get();
 }
 
-// Allocate memory only once
-template <typename U, typename... Args>
-SharedPtr<U> MakeShared(Args &&...args) {
-    SharedPtr<U> sp;
-    ControlBlockHolder<U> *holder = new ControlBlockHolder<U>(std::forward<Args>(args)...);
-    ++holder->shared_ref_count;
+template <typename T, typename Policy>
+ControlBlockArray<T, Policy> *MakeArrayBlock(size_t size) {
+    return ControlBlockArray<T, Policy>::Create(size, nullptr);
+}
+
+template <typename T, typename Policy>
+ControlBlockArray<T, Policy> *MakeArrayBlock(size_t size, const T &value) {
+    return ControlBlockArray<T, Policy>::Create(size, &value);
+}
+
+// Allocate memory only once. MakeShared<T[]>(n) makes n value-initialized
+// elements, MakeShared<T[]>(n, value) makes n copies of value.
+template <typename U, typename Policy = NonAtomicRefCount, typename... Args>
+SharedPtr<U, Policy> MakeShared(Args &&...args) {
+    SharedPtr<U, Policy> sp;
+    if constexpr (std::is_unbounded_array_v<U>) {
+        auto *block = MakeArrayBlock<std::remove_extent_t<U>, Policy>(std::forward<Args>(args)...);
+        block->AddShared();
+        sp.base_ = block;
+        sp.ptr_ = block->Get();
+    } else {
+        auto *holder = ControlBlockHolder<U, Policy>::Create(std::forward<Args>(args)...);
+        holder->AddShared();
+        sp.base_ = holder;
+        sp.ptr_ = holder->Get();
+        if constexpr (std::is_convertible_v<U *, EnableSharedFromThisBase *>) {
+            sp.AddReferenceToSelf(sp.ptr_);
+        } else {
+        }
+    }
+    return sp;
+}
+
+// Same as MakeShared, but takes memory for the object and its control block
+// from alloc
+template <typename U, typename Policy = NonAtomicRefCount, typename Alloc, typename... Args>
+SharedPtr<U, Policy> AllocateShared(const Alloc &alloc, Args &&...args) {
+    SharedPtr<U, Policy> sp;
+    auto *holder = ControlBlockAllocated<U, Alloc, Policy>::Create(alloc, std::forward<Args>(args)...);
+    holder->AddShared();
     sp.base_ = holder;
     sp.ptr_ = holder->Get();
     if constexpr (std::is_convertible_v<U *, EnableSharedFromThisBase *>) {
@@ -247,29 +558,29 @@ SharedPtr<U> MakeShared(Args &&...args) {
 class EnableSharedFromThisBase {};
 
 // Look for usage examples in tests
-template <typename T>
+template <typename T, typename Policy>
 class EnableSharedFromThis : public EnableSharedFromThisBase {
 public:
-    SharedPtr<T> SharedFromThis() {
-        return SharedPtr<T>(self_);
+    SharedPtr<T, Policy> SharedFromThis() {
+        return SharedPtr<T, Policy>(self_);
     }
 
-    SharedPtr<const T> SharedFromThis() const {
-        return SharedPtr<const T>(self_);
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        return SharedPtr<const T, Policy>(WeakPtr<const T, Policy>(self_));
     }
 
-    WeakPtr<T> WeakFromThis() noexcept {
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
         return self_;
     }
 
-    WeakPtr<const T> WeakFromThis() const noexcept {
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
         return self_;
     }
 
 private:
-    WeakPtr<T> self_;
+    WeakPtr<T, Policy> self_;
 
 private:
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 };
\ No newline at end of file
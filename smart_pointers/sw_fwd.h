@@ -4,13 +4,20 @@
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Reference counting policies, see ref_count.h
+struct NonAtomicRefCount;
+struct AtomicRefCount;
+
+template <typename T, typename Policy = NonAtomicRefCount>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = NonAtomicRefCount>
 class WeakPtr;
 
+template <typename T>
+class AtomicSharedPtr;
+
 class EnableSharedFromThisBase;
 
-template <typename T>
+template <typename T, typename Policy = NonAtomicRefCount>
 class EnableSharedFromThis;
\ No newline at end of file
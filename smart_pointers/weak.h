@@ -4,7 +4,7 @@
 #include "shared.h"
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -17,7 +17,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr(const WeakPtr<U>& other) : ptr_(other.ptr_), base_(other.base_) {
+    WeakPtr(const WeakPtr<U, Policy>& other) : ptr_(other.ptr_), base_(other.base_) {
         IncrementRefCount();
     }
 
@@ -27,7 +27,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr(WeakPtr<U>&& other) : ptr_(other.ptr_), base_(other.base_) {
+    WeakPtr(WeakPtr<U, Policy>&& other) : ptr_(other.ptr_), base_(other.base_) {
         other.ptr_ = nullptr;
         other.base_ = nullptr;
     }
@@ -35,7 +35,7 @@ public:
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
     template <typename U>
-    WeakPtr(const SharedPtr<U>& other) : ptr_(other.ptr_), base_(other.base_) {
+    WeakPtr(const SharedPtr<U, Policy>& other) : ptr_(other.ptr_), base_(other.base_) {
         IncrementRefCount();
     }
 
@@ -54,7 +54,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr& operator=(const WeakPtr<U>& other) {
+    WeakPtr& operator=(const WeakPtr<U, Policy>& other) {
         Unlink();
         ptr_ = other.ptr_;
         base_ = other.base_;
@@ -75,7 +75,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr& operator=(WeakPtr<U>&& other) {
+    WeakPtr& operator=(WeakPtr<U, Policy>&& other) {
         Unlink();
         ptr_ = other.ptr_;
         base_ = other.base_;
@@ -85,7 +85,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr& operator=(const SharedPtr<U>& other) {
+    WeakPtr& operator=(const SharedPtr<U, Policy>& other) {
         Unlink();
         ptr_ = other.ptr_;
         base_ = other.base_;
@@ -116,46 +116,44 @@ public:
     // Observers
 
     size_t UseCount() const {
-        return base_ ? base_->shared_ref_count : static_cast<size_t>(0);
+        return base_ ? base_->UseCount() : static_cast<size_t>(0);
     }
     bool Expired() const {
-        return !base_ || !base_->shared_ref_count;
-    }
-    SharedPtr<T> Lock() const {
-        if (Expired()) {
-            return SharedPtr<T>();
+        return !base_ || !base_->UseCount();
+    }
+    // Takes a shared reference only if the object is still alive, so it is
+    // safe against the last SharedPtr going away concurrently
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> sp;
+        if (base_ && base_->TryAddShared()) {
+            sp.ptr_ = ptr_;
+            sp.base_ = base_;
         }
-        SharedPtr<T> sp;
-        sp.ptr_ = ptr_;
-        sp.base_ = base_;
-        sp.IncrementRefCount();
         return sp;
     }
 
 private:
-    T* ptr_ = nullptr;
-    ControlBlockBase* base_ = nullptr;
+    std::remove_extent_t<T>* ptr_ = nullptr;
+    ControlBlockBase<Policy>* base_ = nullptr;
 
 private:
     void Unlink() {
         if (!base_) {
             return;
         }
-        --base_->weak_ref_count;
-        if (base_->shared_ref_count + base_->weak_ref_count == 0) {
-            delete base_;
-        }
+        std::exchange(base_, nullptr)->ReleaseWeak();
+        ptr_ = nullptr;
     }
     void IncrementRefCount() {
         if (base_) {
-            ++base_->weak_ref_count;
+            base_->AddWeak();
         }
     }
 
 private:
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 };
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+
+// Pause hint for spin loops, lets the sibling hyperthread run and saves power
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Exponential backoff for spin loops: every Pause spins twice as long as the
+// previous one, and once the limit is reached it yields the CPU instead.
+class SpinBackoff {
+public:
+    void Pause() {
+        if (spins_ > kMaxSpins) {
+            std::this_thread::yield();
+            return;
+        }
+        for (int i = 0; i < spins_; ++i) {
+            CpuRelax();
+        }
+        spins_ *= 2;
+    }
+
+    bool IsSpinning() const {
+        return spins_ <= kMaxSpins;
+    }
+
+    void Reset() {
+        spins_ = 1;
+    }
+
+private:
+    static constexpr int kMaxSpins = 1 << 10;
+
+    int spins_ = 1;
+};
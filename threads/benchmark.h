@@ -0,0 +1,735 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <semaphore>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "../data_structures/intrusive_hash.h"
+#include "../data_structures/timer_wheel.h"
+#include "bravo_rw_lock.h"
+#include "buffered_channel.h"
+#include "mpmc_stack.h"
+#include "mpsc_stack.h"
+#include "rw_lock.h"
+#include "rw_spinlock.h"
+#include "sema.h"
+#include "thread_pool.h"
+#include "unbuffered_channel.h"
+
+// Throughput and latency benchmarks for the primitives in this directory,
+// the intrusive containers they are built with, and their std counterparts.
+// Each workload runs for a fixed time with 1, 2, 4, ... up to max_threads
+// threads (single-threaded containers only with one); every thread times each of its operations
+// into its own histogram, so p50/p99/p999 come without shared counters on
+// the hot path. The whole suite is one call:
+//
+//     int main() {
+//         RunThreadsBenchmarks(BenchmarkConfig{}, std::cout);
+//     }
+//
+// and prints a JSON document with one result per workload and thread count.
+
+struct BenchmarkConfig {
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 2u);
+    // read-only lock workloads scale up to this many threads, even past the
+    // number of CPUs
+    size_t max_reader_threads = 64;
+    std::chrono::milliseconds duration{200};
+    // share of Read sections in lock workloads
+    double read_ratio = 0.9;
+    // share of producer threads in channel workloads, at least one thread
+    // always produces and one consumes
+    double producer_ratio = 0.5;
+    int channel_size = 1024;
+    int semaphore_permits = 1;
+    // number of distinct elements in hash table workloads
+    size_t hash_size = 1 << 16;
+    // timer wheel workloads keep timer_count timers armed, each for a random
+    // number of ticks up to timer_horizon
+    size_t timer_count = 1'000'000;
+    uint64_t timer_horizon = 1 << 16;
+    // fork-join workloads: one operation computes fib(fib_n) or sorts
+    // sort_size random ints on a pool of 1, 2, 4, ... max_threads workers
+    int fib_n = 30;
+    size_t sort_size = 1 << 18;
+    // runs only workloads whose name contains filter
+    std::string filter;
+};
+
+// Log-linear latency histogram: values below 16ns are exact, above that
+// every power of two is split into 16 buckets, so any percentile is off by
+// at most 1/16 of its value.
+class LatencyHistogram {
+public:
+    void Record(uint64_t ns) {
+        ++buckets_[BucketOf(ns)];
+        ++count_;
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+    }
+
+    uint64_t Count() const {
+        return count_;
+    }
+
+    // Upper bound of the bucket holding the given quantile
+    uint64_t PercentileNs(double quantile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * (count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return UpperBound(i);
+            }
+        }
+        return UpperBound(kBuckets - 1);
+    }
+
+private:
+    static constexpr int kSubBits = 4;
+    static constexpr size_t kSubBuckets = size_t{1} << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+    static size_t BucketOf(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return ns;
+        }
+        int exponent = std::bit_width(ns) - 1;
+        size_t sub = (ns >> (exponent - kSubBits)) & (kSubBuckets - 1);
+        return (exponent - kSubBits + 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t UpperBound(size_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        int exponent = bucket / kSubBuckets + kSubBits - 1;
+        uint64_t sub = bucket % kSubBuckets;
+        return ((kSubBuckets + sub + 1) << (exponent - kSubBits)) - 1;
+    }
+
+    std::vector<uint64_t> buckets_ = std::vector<uint64_t>(kBuckets);
+    uint64_t count_ = 0;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    size_t threads = 0;
+    uint64_t ops = 0;
+    double seconds = 0;
+    LatencyHistogram latency;
+
+    void Dump(std::ostream& out) const {
+        out << "{\"name\":\"" << name << "\",\"threads\":" << threads << ",\"ops\":" << ops
+            << ",\"seconds\":" << seconds << ",\"ops_per_sec\":" << (seconds > 0 ? ops / seconds : 0)
+            << ",\"p50_ns\":" << latency.PercentileNs(0.5) << ",\"p99_ns\":" << latency.PercentileNs(0.99)
+            << ",\"p999_ns\":" << latency.PercentileNs(0.999) << ",\"max_ns\":" << latency.PercentileNs(1)
+            << "}";
+    }
+};
+
+// Runs op(thread_index) in a loop on every thread for config.duration.
+// op returns how many operations it has completed, calls that completed
+// none are not recorded. on_stop runs once time is up, it must unblock
+// threads still waiting inside op (e.g. close a channel).
+template <class Op, class OnStop>
+BenchmarkResult RunBenchmark(std::string name, size_t threads, const BenchmarkConfig& config, Op op,
+                             OnStop on_stop) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<LatencyHistogram> histograms(threads);
+    std::vector<uint64_t> ops(threads);
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::atomic<bool> stop = false;
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            ready.fetch_add(1);
+            while (!start.load(std::memory_order_acquire)) {
+                CpuRelax();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto begin = Clock::now();
+                uint64_t done = op(i);
+                auto end = Clock::now();
+                if (done) {
+                    histograms[i].Record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+                    ops[i] += done;
+                }
+            }
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+
+    auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(config.duration);
+    stop.store(true);
+    auto end = Clock::now();
+    on_stop();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    BenchmarkResult result;
+    result.name = std::move(name);
+    result.threads = threads;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    for (size_t i = 0; i < threads; ++i) {
+        result.ops += ops[i];
+        result.latency.Merge(histograms[i]);
+    }
+    return result;
+}
+
+namespace benchmark_detail {
+
+// Bounded mutex and condition variable queue, the usual hand-rolled channel
+template <class T>
+class StdChannel {
+public:
+    explicit StdChannel(int size) : size_(size) {
+    }
+
+    void Send(const T& value) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            can_send_.wait(lock, [&] { return closed_ || queue_.size() < size_; });
+            if (closed_) {
+                throw std::runtime_error("");
+            }
+            queue_.push_back(value);
+        }
+        can_recv_.notify_one();
+    }
+
+    std::optional<T> Recv() {
+        std::optional<T> value;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            can_recv_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return std::nullopt;
+            }
+            value = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        can_send_.notify_one();
+        return value;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        can_send_.notify_all();
+        can_recv_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable can_send_;
+    std::condition_variable can_recv_;
+    std::deque<T> queue_;
+    size_t size_;
+    bool closed_ = false;
+};
+
+struct RWSpinLockAdapter {
+    template <class Func>
+    void Read(Func func) {
+        lock.LockRead();
+        func();
+        lock.UnlockRead();
+    }
+
+    template <class Func>
+    void Write(Func func) {
+        lock.LockWrite();
+        func();
+        lock.UnlockWrite();
+    }
+
+    RWSpinLock lock;
+};
+
+struct SharedMutexAdapter {
+    template <class Func>
+    void Read(Func func) {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        func();
+    }
+
+    template <class Func>
+    void Write(Func func) {
+        std::lock_guard<std::shared_mutex> guard(lock);
+        func();
+    }
+
+    std::shared_mutex lock;
+};
+
+struct SemaphoreAdapter {
+    explicit SemaphoreAdapter(int permits) : sema(permits) {
+    }
+
+    void Enter() {
+        sema.Enter();
+    }
+
+    void Leave() {
+        sema.Leave();
+    }
+
+    Semaphore sema;
+};
+
+struct StdSemaphoreAdapter {
+    explicit StdSemaphoreAdapter(int permits) : sema(permits) {
+    }
+
+    void Enter() {
+        sema.acquire();
+    }
+
+    void Leave() {
+        sema.release();
+    }
+
+    std::counting_semaphore<> sema;
+};
+
+struct HashNode : ListHook {
+    const uint64_t& GetKey() const {
+        return key;
+    }
+
+    uint64_t key = 0;
+};
+
+struct HashNodeHash {
+    size_t operator()(const HashNode* node) const {
+        return std::hash<uint64_t>()(node->key);
+    }
+};
+
+struct HashNodeEqual {
+    bool operator()(const HashNode* left, const HashNode* right) const {
+        return left->key == right->key;
+    }
+};
+
+// Toggle erases the node if it is in the table and inserts it otherwise
+struct IntrusiveHashAdapter {
+    void Toggle(HashNode* node) {
+        if (table.Find(node->key)) {
+            table.Erase(node);
+        } else {
+            table.Insert(node);
+        }
+    }
+
+    IntrusiveHashMap<HashNode, uint64_t> table;
+};
+
+struct StdUnorderedSetAdapter {
+    void Toggle(HashNode* node) {
+        auto it = set.find(node);
+        if (it != set.end()) {
+            set.erase(it);
+        } else {
+            set.insert(node);
+        }
+    }
+
+    std::unordered_set<HashNode*, HashNodeHash, HashNodeEqual> set;
+};
+
+struct Timer : TimerEntry {};
+
+// Per-thread xorshift, decides between read and write sections
+struct alignas(64) Random {
+    uint64_t Next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    bool Chance(double ratio) {
+        return (Next() >> 11) * 0x1.0p-53 < ratio;
+    }
+
+    uint64_t state;
+};
+
+inline std::vector<size_t> ThreadCounts(size_t min, size_t max) {
+    std::vector<size_t> counts;
+    for (size_t threads = min; threads < max; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(std::max(min, max));
+    return counts;
+}
+
+template <class Lock>
+BenchmarkResult RunRWLockBenchmark(std::string name, size_t threads, const BenchmarkConfig& config) {
+    Lock lock;
+    uint64_t data[4] = {};
+    std::vector<Random> random(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        random[i].state = i * 0x9e3779b97f4a7c15 + 1;
+    }
+    return RunBenchmark(
+        std::move(name), threads, config,
+        [&](size_t thread) -> uint64_t {
+            if (random[thread].Chance(config.read_ratio)) {
+                uint64_t sum = 0;
+                lock.Read([&] {
+                    for (uint64_t value : data) {
+                        sum += value;
+                    }
+                });
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                (void)sum;
+            } else {
+                lock.Write([&] {
+                    for (uint64_t& value : data) {
+                        ++value;
+                    }
+                });
+            }
+            return 1;
+        },
+        [] {});
+}
+
+template <class Sema>
+BenchmarkResult RunSemaphoreBenchmark(std::string name, size_t threads, const BenchmarkConfig& config) {
+    Sema sema(config.semaphore_permits);
+    return RunBenchmark(
+        std::move(name), threads, config,
+        [&](size_t) -> uint64_t {
+            sema.Enter();
+            sema.Leave();
+            return 1;
+        },
+        [] {});
+}
+
+// Counts both sends and receives. Producers stop on the exception Send
+// throws once the channel is closed, consumers on an empty Recv.
+template <class Channel>
+BenchmarkResult RunChannelBenchmark(std::string name, size_t threads, const BenchmarkConfig& config,
+                                    Channel& channel) {
+    size_t producers = std::clamp<size_t>(threads * config.producer_ratio + 0.5, 1, threads - 1);
+    return RunBenchmark(
+        std::move(name), threads, config,
+        [&](size_t thread) -> uint64_t {
+            if (thread < producers) {
+                try {
+                    channel.Send(static_cast<int>(thread));
+                } catch (const std::runtime_error&) {
+                    return 0;
+                }
+                return 1;
+            }
+            return channel.Recv() ? 1 : 0;
+        },
+        [&] { channel.Close(); });
+}
+
+// Random inserts and erases over hash_size nodes, so the table stays about
+// half full and every insert into std::unordered_set allocates a node
+template <class Table>
+BenchmarkResult RunHashBenchmark(std::string name, const BenchmarkConfig& config) {
+    std::vector<HashNode> nodes(config.hash_size);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].key = i;
+    }
+    Table table;
+    Random random{0x9e3779b97f4a7c15};
+    return RunBenchmark(
+        std::move(name), 1, config,
+        [&](size_t) -> uint64_t {
+            table.Toggle(&nodes[random.Next() % nodes.size()]);
+            return 1;
+        },
+        [] {});
+}
+
+inline void ArmTimers(std::vector<Timer>& timers, TimerWheel<Timer>& wheel, Random& random,
+                      const BenchmarkConfig& config) {
+    for (Timer& timer : timers) {
+        wheel.ScheduleAfter(&timer, 1 + random.Next() % config.timer_horizon);
+    }
+}
+
+// Pushes back the deadline of a random armed timer, as a connection timeout
+// does on every read
+inline BenchmarkResult RunTimerRearmBenchmark(const BenchmarkConfig& config) {
+    std::vector<Timer> timers(config.timer_count);
+    TimerWheel<Timer> wheel;
+    Random random{0x9e3779b97f4a7c15};
+    ArmTimers(timers, wheel, random, config);
+    return RunBenchmark(
+        "timer_wheel_rearm", 1, config,
+        [&](size_t) -> uint64_t {
+            wheel.ScheduleAfter(&timers[random.Next() % timers.size()], 1 + random.Next() % config.timer_horizon);
+            return 1;
+        },
+        [] {});
+}
+
+// One operation is one tick: expires due timers and rearms them, so
+// timer_count stay armed. Cascades show up in the tail latency.
+inline BenchmarkResult RunTimerTickBenchmark(const BenchmarkConfig& config) {
+    std::vector<Timer> timers(config.timer_count);
+    TimerWheel<Timer> wheel;
+    Random random{0x9e3779b97f4a7c15};
+    ArmTimers(timers, wheel, random, config);
+    return RunBenchmark(
+        "timer_wheel_tick", 1, config,
+        [&](size_t) -> uint64_t {
+            wheel.Advance(1, [&](Timer& timer) {
+                wheel.ScheduleAfter(&timer, 1 + random.Next() % config.timer_horizon);
+            });
+            return 1;
+        },
+        [] {});
+}
+
+// Every thread pushes and pops the same stack, so each Pop pays for one
+// guard and one retire of the reclamation scheme
+template <class Reclaimer>
+BenchmarkResult RunMPMCStackBenchmark(std::string name, size_t threads, const BenchmarkConfig& config) {
+    MPMCStack<int, Reclaimer> stack;
+    return RunBenchmark(
+        std::move(name), threads, config,
+        [&](size_t thread) -> uint64_t {
+            stack.Push(static_cast<int>(thread));
+            stack.Pop();
+            return 1;
+        },
+        [] {});
+}
+
+// Below these sizes fork-join recursion goes sequential, so the tasks are
+// small enough to expose pool overhead but not dominated by it
+inline constexpr int kFibCutoff = 16;
+inline constexpr size_t kSortCutoff = 1 << 12;
+
+inline uint64_t Fib(int n) {
+    return n < 2 ? n : Fib(n - 1) + Fib(n - 2);
+}
+
+// Forks one branch and computes the other inline; Get runs other tasks
+// while the forked one is stolen and still running
+inline uint64_t ParallelFib(ThreadPool& pool, int n) {
+    if (n < kFibCutoff) {
+        return Fib(n);
+    }
+    Future<uint64_t> left = pool.Submit([&pool, n] { return ParallelFib(pool, n - 1); });
+    uint64_t right = ParallelFib(pool, n - 2);
+    return left.Get() + right;
+}
+
+// Merge sort: halves are sorted in parallel, then merged in place
+inline void ParallelSort(ThreadPool& pool, int* first, int* last) {
+    if (static_cast<size_t>(last - first) <= kSortCutoff) {
+        std::sort(first, last);
+        return;
+    }
+    int* middle = first + (last - first) / 2;
+    Future<void> left = pool.Submit([&pool, first, middle] { ParallelSort(pool, first, middle); });
+    ParallelSort(pool, middle, last);
+    left.Get();
+    std::inplace_merge(first, middle, last);
+}
+
+// Fork-join workloads are driven by one thread that submits the root task
+// and waits for it, threads is the number of pool workers
+inline BenchmarkResult RunForkJoinFibBenchmark(size_t threads, const BenchmarkConfig& config) {
+    ThreadPool pool(threads);
+    BenchmarkResult result = RunBenchmark(
+        "thread_pool_fib", 1, config,
+        [&](size_t) -> uint64_t {
+            uint64_t value = pool.Submit([&] { return ParallelFib(pool, config.fib_n); }).Get();
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            (void)value;
+            return 1;
+        },
+        [] {});
+    result.threads = threads;
+    return result;
+}
+
+inline BenchmarkResult RunForkJoinSortBenchmark(size_t threads, const BenchmarkConfig& config) {
+    ThreadPool pool(threads);
+    std::vector<int> input(config.sort_size);
+    Random random{0x9e3779b97f4a7c15};
+    for (int& value : input) {
+        value = static_cast<int>(random.Next());
+    }
+    std::vector<int> data;
+    BenchmarkResult result = RunBenchmark(
+        "thread_pool_sort", 1, config,
+        [&](size_t) -> uint64_t {
+            data = input;
+            pool.Submit([&] { ParallelSort(pool, data.data(), data.data() + data.size()); }).Get();
+            return 1;
+        },
+        [] {});
+    result.threads = threads;
+    return result;
+}
+
+// All threads but one push, the last one drains the stack
+inline BenchmarkResult RunMPSCStackBenchmark(size_t threads, const BenchmarkConfig& config) {
+    MPSCStack<int> stack;
+    return RunBenchmark(
+        "mpsc_stack", threads, config,
+        [&](size_t thread) -> uint64_t {
+            if (thread + 1 < threads) {
+                stack.Push(static_cast<int>(thread));
+                return 1;
+            }
+            uint64_t count = 0;
+            stack.DequeueAll([&](const int&) { ++count; });
+            return count;
+        },
+        [] {});
+}
+
+}  // namespace benchmark_detail
+
+// Runs every workload from the config and writes results to out as JSON
+inline void RunThreadsBenchmarks(const BenchmarkConfig& config, std::ostream& out) {
+    using namespace benchmark_detail;
+
+    bool first = true;
+    auto report = [&](const BenchmarkResult& result) {
+        out << (first ? "\n" : ",\n") << "    ";
+        result.Dump(out);
+        first = false;
+    };
+    auto enabled = [&](const std::string& name) {
+        return name.find(config.filter) != std::string::npos;
+    };
+
+    out << "{\"config\":{\"max_threads\":" << config.max_threads
+        << ",\"max_reader_threads\":" << config.max_reader_threads
+        << ",\"duration_ms\":" << config.duration.count() << ",\"read_ratio\":" << config.read_ratio
+        << ",\"producer_ratio\":" << config.producer_ratio << ",\"channel_size\":" << config.channel_size
+        << ",\"semaphore_permits\":" << config.semaphore_permits << ",\"hash_size\":" << config.hash_size
+        << ",\"timer_count\":" << config.timer_count << ",\"timer_horizon\":" << config.timer_horizon
+        << ",\"fib_n\":" << config.fib_n << ",\"sort_size\":" << config.sort_size
+        << "},\n\"results\":[";
+
+    if (enabled("intrusive_hash_map")) {
+        report(RunHashBenchmark<IntrusiveHashAdapter>("intrusive_hash_map", config));
+    }
+    if (enabled("std_unordered_set")) {
+        report(RunHashBenchmark<StdUnorderedSetAdapter>("std_unordered_set", config));
+    }
+    if (enabled("timer_wheel_rearm")) {
+        report(RunTimerRearmBenchmark(config));
+    }
+    if (enabled("timer_wheel_tick")) {
+        report(RunTimerTickBenchmark(config));
+    }
+
+    for (size_t threads : ThreadCounts(1, config.max_threads)) {
+        if (enabled("rw_lock")) {
+            report(RunRWLockBenchmark<RWLock>("rw_lock", threads, config));
+        }
+        if (enabled("bravo_rw_lock")) {
+            report(RunRWLockBenchmark<BravoRWLock<>>("bravo_rw_lock", threads, config));
+        }
+        if (enabled("rw_spinlock")) {
+            report(RunRWLockBenchmark<RWSpinLockAdapter>("rw_spinlock", threads, config));
+        }
+        if (enabled("std_shared_mutex")) {
+            report(RunRWLockBenchmark<SharedMutexAdapter>("std_shared_mutex", threads, config));
+        }
+        if (enabled("mpmc_stack_hazard")) {
+            report(RunMPMCStackBenchmark<HazardPointerReclaimer>("mpmc_stack_hazard", threads, config));
+        }
+        if (enabled("mpmc_stack_epoch")) {
+            report(RunMPMCStackBenchmark<EpochReclaimer>("mpmc_stack_epoch", threads, config));
+        }
+        if (enabled("semaphore")) {
+            report(RunSemaphoreBenchmark<SemaphoreAdapter>("semaphore", threads, config));
+        }
+        if (enabled("std_counting_semaphore")) {
+            report(RunSemaphoreBenchmark<StdSemaphoreAdapter>("std_counting_semaphore", threads, config));
+        }
+        if (enabled("thread_pool_fib")) {
+            report(RunForkJoinFibBenchmark(threads, config));
+        }
+        if (enabled("thread_pool_sort")) {
+            report(RunForkJoinSortBenchmark(threads, config));
+        }
+    }
+    // reader scaling: nothing but Read sections
+    BenchmarkConfig readers = config;
+    readers.read_ratio = 1;
+    for (size_t threads : ThreadCounts(1, config.max_reader_threads)) {
+        if (enabled("rw_lock_readers")) {
+            report(RunRWLockBenchmark<RWLock>("rw_lock_readers", threads, readers));
+        }
+        if (enabled("bravo_rw_lock_readers")) {
+            report(RunRWLockBenchmark<BravoRWLock<>>("bravo_rw_lock_readers", threads, readers));
+        }
+        if (enabled("std_shared_mutex_readers")) {
+            report(RunRWLockBenchmark<SharedMutexAdapter>("std_shared_mutex_readers", threads, readers));
+        }
+    }
+    // channel and stack workloads need a producer and a consumer
+    for (size_t threads : ThreadCounts(2, config.max_threads)) {
+        if (enabled("buffered_channel")) {
+            BufferedChannel<int> channel(config.channel_size);
+            report(RunChannelBenchmark("buffered_channel", threads, config, channel));
+        }
+        if (enabled("unbuffered_channel")) {
+            UnbufferedChannel<int> channel;
+            report(RunChannelBenchmark("unbuffered_channel", threads, config, channel));
+        }
+        if (enabled("std_channel")) {
+            StdChannel<int> channel(config.channel_size);
+            report(RunChannelBenchmark("std_channel", threads, config, channel));
+        }
+        if (enabled("mpsc_stack")) {
+            report(RunMPSCStackBenchmark(threads, config));
+        }
+    }
+    out << "\n]}\n";
+}
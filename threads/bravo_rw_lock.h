@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "backoff.h"
+#include "rw_lock.h"
+
+namespace bravo_detail {
+
+inline constexpr size_t kSlotBits = 10;
+inline constexpr size_t kSlotCount = size_t{1} << kSlotBits;
+
+struct alignas(64) ReaderSlot {
+    std::atomic<const void*> lock = nullptr;
+};
+
+// Visible readers table shared by all BravoRWLock-s. Reader publishes the
+// lock address in the slot its (thread, lock) pair hashes to.
+inline ReaderSlot reader_slots[kSlotCount];
+
+inline size_t SlotIndex(const void* lock) {
+    static thread_local char thread_key;
+    uint64_t key = reinterpret_cast<uintptr_t>(lock) ^ (reinterpret_cast<uintptr_t>(&thread_key) << 16);
+    return (key * 0x9E3779B97F4A7C15) >> (64 - kSlotBits);
+}
+
+}  // namespace bravo_detail
+
+// BRAVO (biased reader/writer) lock on top of an underlying Read/Write lock.
+// While read bias is on, reader only does a CAS on its own slot of a global
+// table and rechecks the bias, so readers of a hot lock never share a cache
+// line. Writer takes the underlying lock, turns the bias off and waits until
+// no slot holds this lock. Bias stays off for kInhibitFactor times the
+// revocation cost, so write-heavy locks don't pay for revocation on every
+// write. Readers that hit an occupied slot or a revoked bias use the
+// underlying lock.
+template <class Lock = RWLock>
+class BravoRWLock {
+public:
+    template <class Func>
+    void Read(Func func) {
+        if (read_bias_.load(std::memory_order_relaxed)) {
+            auto& slot = bravo_detail::reader_slots[bravo_detail::SlotIndex(this)].lock;
+            const void* expected = nullptr;
+            if (slot.compare_exchange_strong(expected, this)) {
+                if (read_bias_.load()) {
+                    SlotGuard guard{slot};
+                    func();
+                    return;
+                }
+                slot.store(nullptr, std::memory_order_release);
+            }
+        }
+        lock_.Read([&] {
+            // writers are excluded here, so bias can be turned back on
+            if (!read_bias_.load(std::memory_order_relaxed) &&
+                Now() >= inhibit_until_.load(std::memory_order_relaxed)) {
+                read_bias_.store(true);
+            }
+            func();
+        });
+    }
+
+    template <class Func>
+    void Write(Func func) {
+        lock_.Write([&] {
+            if (read_bias_.load(std::memory_order_relaxed)) {
+                Revoke();
+            }
+            func();
+        });
+    }
+
+private:
+    static constexpr int64_t kInhibitFactor = 9;
+
+    struct SlotGuard {
+        ~SlotGuard() {
+            slot.store(nullptr, std::memory_order_release);
+        }
+
+        std::atomic<const void*>& slot;
+    };
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Pairs with the bias recheck in Read: either reader sees the bias off,
+    // or we see its slot.
+    void Revoke() {
+        read_bias_.store(false);
+        int64_t start = Now();
+        for (bravo_detail::ReaderSlot& slot : bravo_detail::reader_slots) {
+            SpinBackoff backoff;
+            while (slot.lock.load() == this) {
+                backoff.Pause();
+            }
+        }
+        int64_t now = Now();
+        inhibit_until_.store(now + (now - start) * kInhibitFactor, std::memory_order_relaxed);
+    }
+
+    std::atomic<bool> read_bias_ = true;
+    std::atomic<int64_t> inhibit_until_ = 0;
+    Lock lock_;
+};
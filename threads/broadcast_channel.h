@@ -0,0 +1,290 @@
+#pragma once
+
+#include "../data_structures/intrusive_list.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+enum class SlowSubscriberPolicy {
+    kBlock,  // sender waits for the slowest subscriber
+    kDrop,   // subscriber that holds the sender back is dropped
+};
+
+// Disruptor-style broadcast channel: one sender writes every value once into
+// a ring, every subscriber reads it through its own cursor. Sender may reuse
+// a slot only after all subscribers have passed it. The slowest cursor is
+// rescanned only when the ring looks full.
+//
+// Subscribers may join and leave at any time; new subscriber sees values sent
+// after it joined.
+template <class T>
+class BroadcastChannel {
+    static constexpr size_t kCacheLine = 64;
+
+public:
+    class Subscriber : public ListHook {
+    public:
+        Subscriber(const Subscriber&) = delete;
+        Subscriber& operator=(const Subscriber&) = delete;
+
+        ~Subscriber() {
+            channel_.Leave(this);
+        }
+
+        // Returns std::nullopt once channel is closed and drained, or after
+        // subscriber was dropped.
+        std::optional<T> Recv() {
+            return channel_.Read(this, true);
+        }
+
+        std::optional<T> TryRecv() {
+            return channel_.Read(this, false);
+        }
+
+        bool IsDropped() const {
+            return cursor_.load(std::memory_order_acquire) == kDropped;
+        }
+
+    private:
+        friend class BroadcastChannel;
+
+        Subscriber(BroadcastChannel& channel, uint64_t cursor) : channel_(channel), cursor_(cursor) {
+        }
+
+        BroadcastChannel& channel_;
+        // next sequence to read, kBusy is set while value is copied out
+        alignas(kCacheLine) std::atomic<uint64_t> cursor_;
+    };
+
+    explicit BroadcastChannel(size_t size, SlowSubscriberPolicy policy = SlowSubscriberPolicy::kBlock)
+        : capacity_(RoundUp(size)), policy_(policy), slots_(new Slot[capacity_]) {
+        assert(size > 0);
+    }
+
+    BroadcastChannel(const BroadcastChannel&) = delete;
+    BroadcastChannel& operator=(const BroadcastChannel&) = delete;
+
+    // All subscribers must leave before channel is destroyed
+    ~BroadcastChannel() {
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].Destroy();
+        }
+    }
+
+    std::unique_ptr<Subscriber> Subscribe() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<Subscriber> subscriber(
+            new Subscriber(*this, published_.load(std::memory_order_acquire)));
+        subscribers_.PushBack(subscriber.get());
+        return subscriber;
+    }
+
+    // Send and Emplace must be called from one thread at a time. Like other
+    // channels, Send throws after Close.
+    void Send(const T& value) {
+        Emplace(value);
+    }
+
+    void Send(T&& value) {
+        Emplace(std::move(value));
+    }
+
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        if (closed_.load(std::memory_order_relaxed)) {
+            throw std::runtime_error("");
+        }
+        uint64_t seq = next_;
+        if (seq - gating_ >= capacity_) {
+            gating_ = WaitGating(seq);
+        }
+        Slot& slot = slots_[seq & (capacity_ - 1)];
+        slot.Destroy();
+        // if T throws the slot stays empty and seq is not published
+        new (slot.Get()) T(std::forward<Args>(args)...);
+        slot.live = true;
+        next_ = seq + 1;
+        published_.store(seq + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (recv_parked_.load(std::memory_order_relaxed) > 0) {
+            recv_wake_.fetch_add(1);
+            recv_wake_.notify_all();
+        }
+    }
+
+    void Close() {
+        closed_ = true;
+        recv_wake_.fetch_add(1);
+        recv_wake_.notify_all();
+        WakeSender();
+    }
+
+private:
+    static constexpr uint64_t kBusy = uint64_t{1} << 63;
+    static constexpr uint64_t kDropped = ~uint64_t{0};
+    static constexpr int kSpinCount = 64;
+
+    struct Slot {
+        T* Get() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        void Destroy() {
+            if (live) {
+                live = false;
+                Get()->~T();
+            }
+        }
+
+        alignas(T) unsigned char storage[sizeof(T)];
+        // touched by the sender only, readers see published slots
+        bool live = false;
+    };
+
+    static size_t RoundUp(size_t count) {
+        size_t result = 1;
+        while (result < count) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    std::optional<T> Read(Subscriber* subscriber, bool block) {
+        uint64_t cursor = subscriber->cursor_.load(std::memory_order_relaxed);
+        if (cursor == kDropped) {
+            return std::nullopt;
+        }
+        if (!WaitPublished(cursor, block)) {
+            return std::nullopt;
+        }
+        if (policy_ == SlowSubscriberPolicy::kDrop &&
+            !subscriber->cursor_.compare_exchange_strong(cursor, cursor | kBusy)) {
+            return std::nullopt;
+        }
+        std::optional<T> result(*slots_[cursor & (capacity_ - 1)].Get());
+        subscriber->cursor_.store(cursor + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (send_parked_.load(std::memory_order_relaxed)) {
+            WakeSender();
+        }
+        return result;
+    }
+
+    // Returns false if nothing was published after cursor and channel is
+    // closed (or block is false).
+    bool WaitPublished(uint64_t cursor, bool block) {
+        for (int i = 0; i < kSpinCount; ++i) {
+            if (published_.load(std::memory_order_acquire) > cursor) {
+                return true;
+            }
+            if (!block || closed_.load(std::memory_order_relaxed)) {
+                return published_.load(std::memory_order_acquire) > cursor;
+            }
+        }
+        while (true) {
+            uint32_t epoch = recv_wake_.load();
+            recv_parked_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool ready = published_.load(std::memory_order_acquire) > cursor;
+            if (!ready && !closed_) {
+                recv_wake_.wait(epoch);
+            }
+            recv_parked_.fetch_sub(1);
+            if (ready || published_.load(std::memory_order_acquire) > cursor) {
+                return true;
+            }
+            if (closed_) {
+                return false;
+            }
+        }
+    }
+
+    // Blocks until every subscriber has passed seq - capacity_, returns the
+    // slowest cursor.
+    uint64_t WaitGating(uint64_t seq) {
+        while (true) {
+            uint32_t epoch = send_wake_.load();
+            send_parked_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t gating = seq;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (Subscriber& subscriber : subscribers_) {
+                    uint64_t cursor = subscriber.cursor_.load(std::memory_order_acquire);
+                    if (cursor == kDropped) {
+                        continue;
+                    }
+                    cursor &= ~kBusy;
+                    if (seq - cursor >= capacity_ && policy_ == SlowSubscriberPolicy::kDrop) {
+                        Drop(&subscriber, seq);
+                        continue;
+                    }
+                    gating = std::min(gating, cursor);
+                }
+            }
+            if (seq - gating < capacity_) {
+                send_parked_.store(false, std::memory_order_relaxed);
+                return gating;
+            }
+            if (closed_) {
+                send_parked_.store(false, std::memory_order_relaxed);
+                throw std::runtime_error("");
+            }
+            send_wake_.wait(epoch);
+        }
+    }
+
+    // Waits out a copy in progress, subscriber may catch up meanwhile.
+    void Drop(Subscriber* subscriber, uint64_t seq) {
+        uint64_t cursor = subscriber->cursor_.load(std::memory_order_acquire);
+        while (seq - (cursor & ~kBusy) >= capacity_) {
+            if (cursor & kBusy) {
+                cursor = subscriber->cursor_.load(std::memory_order_acquire);
+                continue;
+            }
+            if (subscriber->cursor_.compare_exchange_weak(cursor, kDropped)) {
+                return;
+            }
+        }
+    }
+
+    void Leave(Subscriber* subscriber) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            subscriber->Unlink();
+        }
+        WakeSender();
+    }
+
+    void WakeSender() {
+        send_wake_.fetch_add(1);
+        send_wake_.notify_one();
+    }
+
+    const size_t capacity_;
+    const SlowSubscriberPolicy policy_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic_bool closed_ = false;
+
+    // sender side
+    alignas(kCacheLine) uint64_t next_ = 0;
+    uint64_t gating_ = 0;
+    std::atomic<bool> send_parked_ = false;
+    std::atomic<uint32_t> send_wake_ = 0;
+
+    alignas(kCacheLine) std::atomic<uint64_t> published_ = 0;
+    std::atomic<int> recv_parked_ = 0;
+    std::atomic<uint32_t> recv_wake_ = 0;
+
+    std::mutex mutex_;
+    List<Subscriber> subscribers_;
+};
@@ -1,61 +1,312 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <utility>
 #include <optional>
-#include <queue>
 #include <mutex>
-#include <condition_variable>
+#include <span>
+#include <stdexcept>
 
+#include "instrumentation.h"
+#include "parking_lot.h"
+#include "select.h"
+
+// Mutex and both conditions are single bytes backed by the global parking
+// lot, and the buffer is a ring that grows on demand up to the channel size,
+// so an idle channel takes a few dozen bytes.
 template <class T>
 class BufferedChannel {
 public:
-    explicit BufferedChannel(int size) : size_(size) {
+    using ValueType = T;
+
+    explicit BufferedChannel(int size) : size_(size), queue_(size) {
+        assert(size > 0);
     }
 
     void Send(const T& value) {
+        Emplace(value);
+    }
+
+    void Send(T&& value) {
+        Emplace(std::move(value));
+    }
+
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        bool wake_all = false;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            while (!closed_ && queue_.size() == size_) {
-                can_send_.wait(lock);
-            }
+            std::unique_lock<ParkingMutex> lock(mutex_);
+            WaitCanSend(lock);
             if (closed_) {
                 throw std::runtime_error("");
             }
-            queue_.push(value);
+            queue_.Emplace(std::forward<Args>(args)...);
+            stats_.OnSend(queue_.Size());
+            wake_all = batch_receivers_ > 0;
+            select_waiters_.NotifyAll();
+        }
+        NotifyRecv(wake_all);
+    }
+
+    // SendMany pushes as many values as fit under one lock acquisition and
+    // wakes receivers once per batch, blocking while channel is full.
+    void SendMany(std::span<const T> values) {
+        size_t sent = 0;
+        while (sent < values.size()) {
+            bool wake_all = false;
+            {
+                std::unique_lock<ParkingMutex> lock(mutex_);
+                WaitCanSend(lock);
+                if (closed_) {
+                    throw std::runtime_error("");
+                }
+                size_t count = 0;
+                while (sent < values.size() && queue_.Size() < size_) {
+                    queue_.Emplace(values[sent++]);
+                    ++count;
+                }
+                stats_.OnSend(queue_.Size(), count);
+                wake_all = count > 1 || batch_receivers_ > 0;
+                select_waiters_.NotifyAll();
+            }
+            NotifyRecv(wake_all);
         }
-        can_recv_.notify_one();
     }
 
     std::optional<T> Recv() {
         std::optional<T> res;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            while (!closed_ && queue_.empty()) {
-                can_recv_.wait(lock);
-            }
-            if (queue_.empty()) {
+            std::unique_lock<ParkingMutex> lock(mutex_);
+            WaitCanRecv(lock, 1);
+            if (queue_.IsEmpty()) {
                 return std::nullopt;
             }
-            res = queue_.front();
-            queue_.pop();
+            res = queue_.Pop();
+            stats_.OnRecv(queue_.Size());
+            select_waiters_.NotifyAll();
         }
-        can_send_.notify_one();
+        can_send_.NotifyOne();
         return res;
     }
 
+    // RecvMany waits until at least min values are buffered (or channel is
+    // closed) and moves up to max of them to out under one lock acquisition.
+    // Returns number of received values, 0 means channel is closed and empty.
+    template <class OutputIt>
+    size_t RecvMany(OutputIt out, size_t max, size_t min = 1) {
+        if (max == 0) {
+            return 0;
+        }
+        min = std::clamp<size_t>(min, 1, std::max<size_t>(1, std::min(max, size_)));
+        size_t count = 0;
+        {
+            std::unique_lock<ParkingMutex> lock(mutex_);
+            if (min > 1) {
+                ++batch_receivers_;
+                WaitCanRecv(lock, min);
+                --batch_receivers_;
+            } else {
+                WaitCanRecv(lock, 1);
+            }
+            while (count < max && !queue_.IsEmpty()) {
+                *out++ = queue_.Pop();
+                ++count;
+            }
+            if (count) {
+                stats_.OnRecv(queue_.Size(), count);
+                select_waiters_.NotifyAll();
+            }
+        }
+        if (count == 1) {
+            can_send_.NotifyOne();
+        } else if (count > 1) {
+            can_send_.NotifyAll();
+        }
+        return count;
+    }
+
+    // closed_ is set under the mutex: a waiter that has just seen it false is
+    // already queued on its condition by the time we notify.
     void Close() {
+        std::lock_guard<ParkingMutex> lock(mutex_);
         closed_ = true;
-        can_send_.notify_all();
-        can_recv_.notify_all();
+        can_send_.NotifyAll();
+        can_recv_.NotifyAll();
+        select_waiters_.NotifyAll();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Non-blocking operations used by Select. self is the hook of the
+    // calling case: its Select, if blocked, is claimed right before the case
+    // fires.
+
+    // Returns false if channel is full
+    bool PollSend(const T& value, SelectCaseHook* self = nullptr) {
+        bool wake_all = false;
+        {
+            std::lock_guard<ParkingMutex> lock(mutex_);
+            if (closed_) {
+                if (!ClaimSelectCase(self)) {
+                    return false;
+                }
+                throw std::runtime_error("");
+            }
+            if (queue_.Size() == size_ || !ClaimSelectCase(self)) {
+                return false;
+            }
+            queue_.Emplace(value);
+            stats_.OnSend(queue_.Size());
+            wake_all = batch_receivers_ > 0;
+            select_waiters_.NotifyAll();
+        }
+        NotifyRecv(wake_all);
+        return true;
+    }
+
+    // Returns false if channel is empty and not closed, value stays
+    // std::nullopt if channel is closed.
+    bool PollRecv(std::optional<T>& value, SelectCaseHook* self = nullptr) {
+        {
+            std::lock_guard<ParkingMutex> lock(mutex_);
+            if (queue_.IsEmpty()) {
+                return closed_ && ClaimSelectCase(self);
+            }
+            if (!ClaimSelectCase(self)) {
+                return false;
+            }
+            value = queue_.Pop();
+            stats_.OnRecv(queue_.Size());
+            select_waiters_.NotifyAll();
+        }
+        can_send_.NotifyOne();
+        return true;
+    }
+
+    void AddSelectWaiter(SelectCaseHook* hook) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        select_waiters_.Add(hook);
+    }
+
+    void RemoveSelectWaiter(SelectCaseHook* hook) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        select_waiters_.Remove(hook);
+    }
+
+    const ChannelStats& GetStats() const {
+        return stats_;
     }
 
 private:
-    std::mutex mutex_;
-    std::condition_variable can_send_;
-    std::condition_variable can_recv_;
-    std::queue<T> queue_;
-    int new_index_send_ = 0;
-    int next_index_send_ = 0;
+    void WaitCanSend(std::unique_lock<ParkingMutex>& lock) {
+        if (closed_ || queue_.Size() < size_) {
+            return;
+        }
+        [[maybe_unused]] auto timer = stats_.SendBlocked();
+        while (!closed_ && queue_.Size() == size_) {
+            can_send_.Wait(lock);
+        }
+    }
+
+    void WaitCanRecv(std::unique_lock<ParkingMutex>& lock, size_t min) {
+        if (closed_ || queue_.Size() >= min) {
+            return;
+        }
+        [[maybe_unused]] auto timer = stats_.RecvBlocked();
+        while (!closed_ && queue_.Size() < min) {
+            can_recv_.Wait(lock);
+        }
+    }
+
+    void NotifyRecv(bool wake_all) {
+        if (wake_all) {
+            can_recv_.NotifyAll();
+        } else {
+            can_recv_.NotifyOne();
+        }
+    }
+
+    // FIFO ring, doubles its capacity when full up to the channel size
+    class Ring {
+    public:
+        explicit Ring(size_t max_capacity) : max_capacity_(max_capacity) {
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        ~Ring() {
+            while (!IsEmpty()) {
+                Pop();
+            }
+        }
+
+        size_t Size() const {
+            return count_;
+        }
+
+        bool IsEmpty() const {
+            return count_ == 0;
+        }
+
+        template <class... Args>
+        void Emplace(Args&&... args) {
+            if (count_ == capacity_) {
+                Grow();
+            }
+            new (slots_[(head_ + count_) % capacity_].Get()) T(std::forward<Args>(args)...);
+            ++count_;
+        }
+
+        T Pop() {
+            T* value = slots_[head_].Get();
+            T result(std::move(*value));
+            value->~T();
+            head_ = (head_ + 1) % capacity_;
+            --count_;
+            return result;
+        }
+
+    private:
+        struct Slot {
+            T* Get() {
+                return std::launder(reinterpret_cast<T*>(storage));
+            }
+
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        void Grow() {
+            uint32_t capacity = std::min<size_t>(std::max<size_t>(capacity_ * 2, 1), max_capacity_);
+            std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+            for (uint32_t i = 0; i < count_; ++i) {
+                T* value = slots_[(head_ + i) % capacity_].Get();
+                new (slots[i].Get()) T(std::move(*value));
+                value->~T();
+            }
+            slots_ = std::move(slots);
+            capacity_ = capacity;
+            head_ = 0;
+        }
+
+        std::unique_ptr<Slot[]> slots_;
+        uint32_t max_capacity_;
+        uint32_t capacity_ = 0;
+        uint32_t head_ = 0;
+        uint32_t count_ = 0;
+    };
+
+    ParkingMutex mutex_;
+    ParkingCondition can_send_;
+    ParkingCondition can_recv_;
+    bool closed_ = false;
+    // RecvMany-s waiting for more than one value, they need every Send to wake them
+    int batch_receivers_ = 0;
     size_t size_ = 0;
-    std::atomic_bool closed_ = false;
+    Ring queue_;
+    SelectWaiterList select_waiters_;
+    [[no_unique_address]] ChannelStats stats_;
 };
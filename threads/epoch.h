@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation after Keir Fraser. Readers pin the global epoch for
+// the duration of a critical section, which costs one store and one fence and
+// doesn't depend on how many nodes they touch. A node retired at epoch e is
+// freed once the global epoch reaches e + 2: by then every thread that could
+// have seen it has unpinned. Epoch advances only when every pinned thread has
+// observed the current one, so a stalled reader delays reclamation (but not
+// progress) for everybody, unlike hazard pointers.
+namespace epoch_detail {
+
+// bit 0 is set while the thread is pinned, the rest is the epoch it pinned
+struct alignas(64) Record {
+    std::atomic<uint64_t> state = 0;
+    std::atomic<bool> in_use = false;
+    Record* next = nullptr;
+};
+
+struct Retired {
+    void* ptr;
+    void (*deleter)(void*);
+    uint64_t epoch;
+};
+
+// Pin state of the thread. Trivially destructible, so deleters that run
+// while the thread exits can still pin and retire after ThreadState is gone.
+struct PinState {
+    Record* record = nullptr;
+    size_t depth = 0;
+    // set once ThreadState is being destroyed
+    bool exiting = false;
+};
+
+inline PinState& CurrentPins() {
+    static thread_local PinState pins;
+    return pins;
+}
+
+// Retired nodes left by exited threads, adopted by the next collection.
+// Freed here once no threads are left; deleters may retire more nodes,
+// which land here again.
+struct Orphans {
+    ~Orphans() {
+        CurrentPins().exiting = true;
+        while (true) {
+            std::vector<Retired> batch;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(list);
+            }
+            if (batch.empty()) {
+                break;
+            }
+            for (Retired& retired : batch) {
+                retired.deleter(retired.ptr);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<Retired> list;
+    std::atomic<bool> non_empty = false;
+};
+
+inline std::atomic<uint64_t> global_epoch = 0;
+inline std::atomic<Record*> records = nullptr;
+inline Orphans orphans;
+
+inline Record* AcquireRecord() {
+    for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+        bool expected = false;
+        if (!record->in_use.load(std::memory_order_relaxed) &&
+            record->in_use.compare_exchange_strong(expected, true)) {
+            return record;
+        }
+    }
+    Record* record = new Record;
+    record->in_use.store(true, std::memory_order_relaxed);
+    Record* head = records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!records.compare_exchange_weak(head, record, std::memory_order_release,
+                                            std::memory_order_relaxed));
+    return record;
+}
+
+inline void ReleaseRecord(Record* record) {
+    record->state.store(0, std::memory_order_release);
+    record->in_use.store(false, std::memory_order_release);
+}
+
+template <class It>
+void Orphan(It first, It last) {
+    std::lock_guard<std::mutex> lock(orphans.mutex);
+    orphans.list.insert(orphans.list.end(), first, last);
+    orphans.non_empty.store(true, std::memory_order_release);
+}
+
+class ThreadState {
+public:
+    ~ThreadState() {
+        PinState& pins = CurrentPins();
+        pins.exiting = true;
+        Collect();
+        if (!limbo_.empty()) {
+            Orphan(limbo_.begin(), limbo_.end());
+        }
+        if (pins.record && pins.depth == 0) {
+            ReleaseRecord(std::exchange(pins.record, nullptr));
+        }
+    }
+
+    void Retire(void* ptr, void (*deleter)(void*)) {
+        limbo_.push_back({ptr, deleter, global_epoch.load(std::memory_order_acquire)});
+        if (limbo_.size() >= kCollectThreshold) {
+            TryAdvance();
+            Collect();
+        }
+    }
+
+private:
+    static constexpr size_t kCollectThreshold = 64;
+
+    static void TryAdvance() {
+        uint64_t epoch = global_epoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+            uint64_t state = record->state.load(std::memory_order_acquire);
+            if ((state & 1) && (state >> 1) != epoch) {
+                return;
+            }
+        }
+        global_epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+    void Collect() {
+        if (orphans.non_empty.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(orphans.mutex);
+            limbo_.insert(limbo_.end(), orphans.list.begin(), orphans.list.end());
+            orphans.list.clear();
+            orphans.non_empty.store(false, std::memory_order_relaxed);
+        }
+        uint64_t epoch = global_epoch.load(std::memory_order_acquire);
+        auto kept = std::partition(limbo_.begin(), limbo_.end(),
+                                   [&](const Retired& retired) { return retired.epoch + 2 > epoch; });
+        // deleters may retire again, so the doomed nodes leave limbo_ before
+        // any of them runs; a nested Collect finds spare_ empty
+        std::vector<Retired> doomed = std::move(spare_);
+        doomed.assign(kept, limbo_.end());
+        limbo_.erase(kept, limbo_.end());
+        for (Retired& retired : doomed) {
+            retired.deleter(retired.ptr);
+        }
+        doomed.clear();
+        spare_ = std::move(doomed);
+    }
+
+    std::vector<Retired> limbo_;
+    std::vector<Retired> spare_;
+};
+
+inline ThreadState& CurrentThread() {
+    static thread_local ThreadState state;
+    return state;
+}
+
+inline void Pin() {
+    PinState& pins = CurrentPins();
+    if (pins.depth++) {
+        return;
+    }
+    if (!pins.record) {
+        if (!pins.exiting) {
+            // ThreadState gives the record back when the thread exits
+            CurrentThread();
+        }
+        pins.record = AcquireRecord();
+    }
+    uint64_t epoch = global_epoch.load(std::memory_order_relaxed);
+    pins.record->state.store((epoch << 1) | 1, std::memory_order_relaxed);
+    // pairs with the fence in TryAdvance
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// An exiting thread gives its record back as soon as it unpins
+inline void Unpin() {
+    PinState& pins = CurrentPins();
+    if (--pins.depth) {
+        return;
+    }
+    if (pins.exiting) {
+        ReleaseRecord(std::exchange(pins.record, nullptr));
+    } else {
+        pins.record->state.store(0, std::memory_order_release);
+    }
+}
+
+// Once the thread is exiting, retired nodes go to the orphans
+inline void ThreadRetire(void* ptr, void (*deleter)(void*)) {
+    if (CurrentPins().exiting) {
+        Retired retired{ptr, deleter, global_epoch.load(std::memory_order_acquire)};
+        Orphan(&retired, &retired + 1);
+    } else {
+        CurrentThread().Retire(ptr, deleter);
+    }
+}
+
+}  // namespace epoch_detail
+
+// Pins current epoch for its lifetime, guards may nest
+class EpochGuard {
+public:
+    EpochGuard() {
+        epoch_detail::Pin();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+    ~EpochGuard() {
+        epoch_detail::Unpin();
+    }
+};
+
+// Frees ptr with deleter two epochs later. ptr must be already unreachable
+// for new readers.
+inline void RetireEpoch(void* ptr, void (*deleter)(void*)) {
+    epoch_detail::ThreadRetire(ptr, deleter);
+}
+
+template <class T>
+void RetireEpoch(T* ptr) {
+    RetireEpoch(ptr, [](void* p) { delete static_cast<T*>(p); });
+}
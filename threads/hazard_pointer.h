@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Hazard pointers after Maged Michael. A reader announces the node it is about
+// to dereference in a hazard slot; a retired node is freed only once no slot
+// holds it. Slots are reused between threads through a global lock-free list
+// of records, every thread keeps a few records cached so HazardPointer
+// construction is normally a thread-local pop.
+//
+// Retired nodes wait in a thread-local list, which is scanned once it grows
+// past twice the number of slots, so reclamation is amortized O(1) per node.
+namespace hazard_pointer_detail {
+
+struct alignas(64) Record {
+    std::atomic<const void*> hazard = nullptr;
+    std::atomic<bool> active = false;
+    Record* next = nullptr;
+};
+
+struct Retired {
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+// Set once the thread's ThreadState is being destroyed. Trivially
+// destructible, so deleters that run after that can still read it and keep
+// away from ThreadState.
+inline bool& ThreadExiting() {
+    static thread_local bool exiting = false;
+    return exiting;
+}
+
+// Retired nodes left by exited threads, adopted by the next scan. Freed
+// here once no threads are left; deleters may retire more nodes, which land
+// here again.
+struct Orphans {
+    ~Orphans() {
+        ThreadExiting() = true;
+        while (true) {
+            std::vector<Retired> batch;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(list);
+            }
+            if (batch.empty()) {
+                break;
+            }
+            for (Retired& retired : batch) {
+                retired.deleter(retired.ptr);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<Retired> list;
+    std::atomic<bool> non_empty = false;
+};
+
+inline std::atomic<Record*> records = nullptr;
+inline std::atomic<size_t> record_count = 0;
+inline Orphans orphans;
+
+inline Record* AcquireRecord() {
+    for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+        bool expected = false;
+        if (!record->active.load(std::memory_order_relaxed) &&
+            record->active.compare_exchange_strong(expected, true)) {
+            return record;
+        }
+    }
+    Record* record = new Record;
+    record->active.store(true, std::memory_order_relaxed);
+    Record* head = records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!records.compare_exchange_weak(head, record, std::memory_order_release,
+                                            std::memory_order_relaxed));
+    record_count.fetch_add(1, std::memory_order_relaxed);
+    return record;
+}
+
+inline void ReleaseRecord(Record* record) {
+    record->hazard.store(nullptr, std::memory_order_release);
+    record->active.store(false, std::memory_order_release);
+}
+
+template <class It>
+void Orphan(It first, It last) {
+    std::lock_guard<std::mutex> lock(orphans.mutex);
+    orphans.list.insert(orphans.list.end(), first, last);
+    orphans.non_empty.store(true, std::memory_order_release);
+}
+
+class ThreadState {
+public:
+    ~ThreadState() {
+        ThreadExiting() = true;
+        Scan();
+        if (!retired_.empty()) {
+            Orphan(retired_.begin(), retired_.end());
+        }
+        for (size_t i = 0; i < cached_count_; ++i) {
+            ReleaseRecord(cached_[i]);
+        }
+    }
+
+    Record* Acquire() {
+        if (cached_count_) {
+            return cached_[--cached_count_];
+        }
+        return AcquireRecord();
+    }
+
+    void Release(Record* record) {
+        if (cached_count_ == kCacheSize) {
+            ReleaseRecord(record);
+            return;
+        }
+        record->hazard.store(nullptr, std::memory_order_release);
+        cached_[cached_count_++] = record;
+    }
+
+    void Retire(void* ptr, void (*deleter)(void*)) {
+        retired_.push_back({ptr, deleter});
+        if (retired_.size() >= std::max<size_t>(kMinScan, 2 * record_count.load(std::memory_order_relaxed))) {
+            Scan();
+        }
+    }
+
+    // Frees every retired node that no hazard slot holds
+    void Scan() {
+        if (orphans.non_empty.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(orphans.mutex);
+            retired_.insert(retired_.end(), orphans.list.begin(), orphans.list.end());
+            orphans.list.clear();
+            orphans.non_empty.store(false, std::memory_order_relaxed);
+        }
+        // pairs with the fence in HazardPointer::Protect
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        hazards_.clear();
+        for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+            if (const void* hazard = record->hazard.load(std::memory_order_acquire)) {
+                hazards_.push_back(hazard);
+            }
+        }
+        std::sort(hazards_.begin(), hazards_.end());
+        auto kept = std::partition(retired_.begin(), retired_.end(), [&](const Retired& retired) {
+            return std::binary_search(hazards_.begin(), hazards_.end(), retired.ptr);
+        });
+        // deleters may retire again, so the doomed nodes leave retired_
+        // before any of them runs; a nested Scan finds spare_ empty
+        std::vector<Retired> doomed = std::move(spare_);
+        doomed.assign(kept, retired_.end());
+        retired_.erase(kept, retired_.end());
+        for (Retired& retired : doomed) {
+            retired.deleter(retired.ptr);
+        }
+        doomed.clear();
+        spare_ = std::move(doomed);
+    }
+
+private:
+    static constexpr size_t kCacheSize = 4;
+    static constexpr size_t kMinScan = 64;
+
+    Record* cached_[kCacheSize];
+    size_t cached_count_ = 0;
+    std::vector<Retired> retired_;
+    std::vector<Retired> spare_;
+    std::vector<const void*> hazards_;
+};
+
+inline ThreadState& CurrentThread() {
+    static thread_local ThreadState state;
+    return state;
+}
+
+// Once the thread is exiting, records come from the global list directly
+// and retired nodes go to the orphans
+inline Record* ThreadAcquire() {
+    return ThreadExiting() ? AcquireRecord() : CurrentThread().Acquire();
+}
+
+inline void ThreadRelease(Record* record) {
+    if (ThreadExiting()) {
+        ReleaseRecord(record);
+    } else {
+        CurrentThread().Release(record);
+    }
+}
+
+inline void ThreadRetire(void* ptr, void (*deleter)(void*)) {
+    if (ThreadExiting()) {
+        Retired retired{ptr, deleter};
+        Orphan(&retired, &retired + 1);
+    } else {
+        CurrentThread().Retire(ptr, deleter);
+    }
+}
+
+}  // namespace hazard_pointer_detail
+
+// Owns one hazard slot for its lifetime
+class HazardPointer {
+public:
+    HazardPointer() : record_(hazard_pointer_detail::ThreadAcquire()) {
+    }
+
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+
+    ~HazardPointer() {
+        hazard_pointer_detail::ThreadRelease(record_);
+    }
+
+    // Loads src and protects the loaded pointer, retrying until src still
+    // holds it after the announcement. Returned node stays valid until the
+    // next Protect or Reset.
+    template <class T>
+    T* Protect(const std::atomic<T*>& src) {
+        T* ptr = src.load(std::memory_order_relaxed);
+        while (true) {
+            record_->hazard.store(ptr, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            T* now = src.load(std::memory_order_acquire);
+            if (now == ptr) {
+                return ptr;
+            }
+            ptr = now;
+        }
+    }
+
+    void Reset() {
+        record_->hazard.store(nullptr, std::memory_order_release);
+    }
+
+private:
+    hazard_pointer_detail::Record* record_;
+};
+
+// Frees ptr with deleter once no hazard pointer protects it. ptr must be
+// already unreachable for new readers.
+inline void RetireHazard(void* ptr, void (*deleter)(void*)) {
+    hazard_pointer_detail::ThreadRetire(ptr, deleter);
+}
+
+template <class T>
+void RetireHazard(T* ptr) {
+    RetireHazard(ptr, [](void* p) { delete static_cast<T*>(p); });
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Opt-in statistics for channels and locks. Build with
+// -DTHREADS_INSTRUMENTATION to turn them on; otherwise every stats class is
+// empty and all its methods are inline no-ops.
+//
+// Uncontended operations only bump relaxed counters, clocks are read only on
+// the blocking path. Read stats with GetStats() and print them with
+// Dump(out, StatsFormat::kText) or Dump(out, StatsFormat::kJson).
+
+enum class StatsFormat { kText, kJson };
+
+#ifdef THREADS_INSTRUMENTATION
+
+// Log2 histogram of blocked time, bucket i counts waits in [2^(i-1), 2^i) ns.
+class WaitHistogram {
+public:
+    void Record(std::chrono::nanoseconds time) {
+        uint64_t ns = time.count() > 0 ? time.count() : 0;
+        size_t bucket = std::min<size_t>(std::bit_width(ns), kBuckets - 1);
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given quantile
+    uint64_t PercentileNs(double quantile) const {
+        uint64_t count = Count();
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return uint64_t{1} << i;
+            }
+        }
+        return uint64_t{1} << (kBuckets - 1);
+    }
+
+    void Dump(std::ostream& out, StatsFormat format) const {
+        uint64_t count = Count();
+        uint64_t total = total_ns_.load(std::memory_order_relaxed);
+        if (format == StatsFormat::kText) {
+            out << "count=" << count << " total_ns=" << total << " p50_ns<=" << PercentileNs(0.5)
+                << " p99_ns<=" << PercentileNs(0.99) << " max_ns<=" << PercentileNs(1);
+            return;
+        }
+        out << "{\"count\":" << count << ",\"total_ns\":" << total << ",\"p50_ns\":" << PercentileNs(0.5)
+            << ",\"p99_ns\":" << PercentileNs(0.99) << ",\"max_ns\":" << PercentileNs(1) << ",\"buckets\":[";
+        for (size_t i = 0; i < kBuckets; ++i) {
+            out << (i ? "," : "") << buckets_[i].load(std::memory_order_relaxed);
+        }
+        out << "]}";
+    }
+
+private:
+    static constexpr size_t kBuckets = 40;
+
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> total_ns_ = 0;
+};
+
+// Records time from construction to destruction into a histogram
+class BlockedTimer {
+public:
+    explicit BlockedTimer(WaitHistogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {
+    }
+
+    BlockedTimer(const BlockedTimer&) = delete;
+    BlockedTimer& operator=(const BlockedTimer&) = delete;
+
+    ~BlockedTimer() {
+        histogram_.Record(std::chrono::steady_clock::now() - start_);
+    }
+
+private:
+    WaitHistogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class DepthGauge {
+public:
+    void Set(size_t depth) {
+        current_.store(depth, std::memory_order_relaxed);
+        size_t peak = peak_.load(std::memory_order_relaxed);
+        while (depth > peak && !peak_.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    size_t Current() const {
+        return current_.load(std::memory_order_relaxed);
+    }
+
+    size_t Peak() const {
+        return peak_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> current_ = 0;
+    std::atomic<size_t> peak_ = 0;
+};
+
+namespace stats_detail {
+
+inline double Seconds(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+inline double Rate(uint64_t count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+}  // namespace stats_detail
+
+// Depth is the number of buffered values (or blocked senders for
+// UnbufferedChannel), blocked histograms count contended operations.
+class ChannelStats {
+public:
+    void OnSend(size_t depth, uint64_t count = 1) {
+        sends_.fetch_add(count, std::memory_order_relaxed);
+        depth_.Set(depth);
+    }
+
+    void OnRecv(size_t depth, uint64_t count = 1) {
+        recvs_.fetch_add(count, std::memory_order_relaxed);
+        depth_.Set(depth);
+    }
+
+    BlockedTimer SendBlocked() {
+        return BlockedTimer(send_blocked_);
+    }
+
+    BlockedTimer RecvBlocked() {
+        return BlockedTimer(recv_blocked_);
+    }
+
+    uint64_t Sends() const {
+        return sends_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Recvs() const {
+        return recvs_.load(std::memory_order_relaxed);
+    }
+
+    const DepthGauge& Depth() const {
+        return depth_;
+    }
+
+    const WaitHistogram& SendBlockedTime() const {
+        return send_blocked_;
+    }
+
+    const WaitHistogram& RecvBlockedTime() const {
+        return recv_blocked_;
+    }
+
+    void Dump(std::ostream& out, StatsFormat format = StatsFormat::kText) const {
+        double seconds = stats_detail::Seconds(created_);
+        if (format == StatsFormat::kText) {
+            out << "sends=" << Sends() << " (" << stats_detail::Rate(Sends(), seconds) << "/s)"
+                << " recvs=" << Recvs() << " (" << stats_detail::Rate(Recvs(), seconds) << "/s)"
+                << " depth=" << depth_.Current() << " peak_depth=" << depth_.Peak() << "\n";
+            out << "send_blocked: ";
+            send_blocked_.Dump(out, format);
+            out << "\nrecv_blocked: ";
+            recv_blocked_.Dump(out, format);
+            out << "\n";
+            return;
+        }
+        out << "{\"sends\":" << Sends() << ",\"send_rate\":" << stats_detail::Rate(Sends(), seconds)
+            << ",\"recvs\":" << Recvs() << ",\"recv_rate\":" << stats_detail::Rate(Recvs(), seconds)
+            << ",\"depth\":" << depth_.Current() << ",\"peak_depth\":" << depth_.Peak()
+            << ",\"send_blocked\":";
+        send_blocked_.Dump(out, format);
+        out << ",\"recv_blocked\":";
+        recv_blocked_.Dump(out, format);
+        out << "}";
+    }
+
+private:
+    std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> sends_ = 0;
+    std::atomic<uint64_t> recvs_ = 0;
+    DepthGauge depth_;
+    WaitHistogram send_blocked_;
+    WaitHistogram recv_blocked_;
+};
+
+// Depth is the number of threads waiting for the lock, blocked histogram
+// counts contended acquisitions.
+class LockStats {
+public:
+    void OnAcquire() {
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void OnWaiters(size_t waiters) {
+        waiters_.Set(waiters);
+    }
+
+    BlockedTimer Blocked() {
+        return BlockedTimer(blocked_);
+    }
+
+    uint64_t Acquisitions() const {
+        return acquisitions_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Contended() const {
+        return blocked_.Count();
+    }
+
+    const DepthGauge& Waiters() const {
+        return waiters_;
+    }
+
+    const WaitHistogram& BlockedTime() const {
+        return blocked_;
+    }
+
+    void Dump(std::ostream& out, StatsFormat format = StatsFormat::kText) const {
+        double seconds = stats_detail::Seconds(created_);
+        if (format == StatsFormat::kText) {
+            out << "acquisitions=" << Acquisitions() << " ("
+                << stats_detail::Rate(Acquisitions(), seconds) << "/s)"
+                << " contended=" << Contended() << " waiters=" << waiters_.Current()
+                << " peak_waiters=" << waiters_.Peak() << "\nblocked: ";
+            blocked_.Dump(out, format);
+            out << "\n";
+            return;
+        }
+        out << "{\"acquisitions\":" << Acquisitions()
+            << ",\"acquisition_rate\":" << stats_detail::Rate(Acquisitions(), seconds)
+            << ",\"contended\":" << Contended() << ",\"waiters\":" << waiters_.Current()
+            << ",\"peak_waiters\":" << waiters_.Peak() << ",\"blocked\":";
+        blocked_.Dump(out, format);
+        out << "}";
+    }
+
+private:
+    std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> acquisitions_ = 0;
+    DepthGauge waiters_;
+    WaitHistogram blocked_;
+};
+
+#else
+
+struct BlockedTimer {};
+
+class ChannelStats {
+public:
+    void OnSend(size_t, uint64_t = 1) {
+    }
+
+    void OnRecv(size_t, uint64_t = 1) {
+    }
+
+    BlockedTimer SendBlocked() {
+        return {};
+    }
+
+    BlockedTimer RecvBlocked() {
+        return {};
+    }
+
+    void Dump(std::ostream& out, StatsFormat format = StatsFormat::kText) const {
+        out << (format == StatsFormat::kJson ? "{}" : "instrumentation disabled\n");
+    }
+};
+
+class LockStats {
+public:
+    void OnAcquire() {
+    }
+
+    void OnWaiters(size_t) {
+    }
+
+    BlockedTimer Blocked() {
+        return {};
+    }
+
+    void Dump(std::ostream& out, StatsFormat format = StatsFormat::kText) const {
+        out << (format == StatsFormat::kJson ? "{}" : "instrumentation disabled\n");
+    }
+};
+
+#endif
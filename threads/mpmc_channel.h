@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+// Bounded channel on a lock-free ring after Dmitry Vyukov's MPMC queue.
+// Every slot carries a sequence number telling whether it is ready to be
+// written (2 * pos) or read (2 * pos + 1) at the current lap, so producers and
+// consumers only contend on their own position counter. Doubling keeps the two
+// states apart even for a single-slot ring.
+//
+// Threads park (atomic wait) only when the ring is really full or empty, and
+// the other side notifies only if somebody is parked. Close semantics match
+// BufferedChannel: Send throws after Close, Recv drains what is left and then
+// returns std::nullopt.
+template <class T>
+class MPMCChannel {
+public:
+    explicit MPMCChannel(size_t size) : size_(size), slots_(new Slot[size]) {
+        assert(size > 0);
+        for (size_t i = 0; i < size_; ++i) {
+            slots_[i].sequence.store(2 * i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCChannel(const MPMCChannel&) = delete;
+    MPMCChannel& operator=(const MPMCChannel&) = delete;
+
+    ~MPMCChannel() {
+        while (TryRecv()) {
+        }
+    }
+
+    void Send(const T& value) {
+        Emplace(value);
+    }
+
+    void Send(T&& value) {
+        Emplace(std::move(value));
+    }
+
+    // Constructs value right in the ring slot. Arguments are consumed only
+    // once the slot is claimed, so retrying doesn't move from them twice.
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        while (true) {
+            for (int i = 0; i < kSpinCount; ++i) {
+                if (closed_.load(std::memory_order_relaxed)) {
+                    throw std::runtime_error("");
+                }
+                if (TryEmplace(std::forward<Args>(args)...)) {
+                    return;
+                }
+            }
+            uint32_t epoch = not_full_.load();
+            send_waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool sent = !closed_ && TryEmplace(std::forward<Args>(args)...);
+            if (!sent && !closed_) {
+                not_full_.wait(epoch);
+            }
+            send_waiters_.fetch_sub(1);
+            if (sent) {
+                return;
+            }
+        }
+    }
+
+    std::optional<T> Recv() {
+        while (true) {
+            for (int i = 0; i < kSpinCount; ++i) {
+                if (auto result = TryRecv()) {
+                    return result;
+                }
+                if (closed_.load(std::memory_order_relaxed)) {
+                    return TryRecv();
+                }
+            }
+            uint32_t epoch = not_empty_.load();
+            recv_waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto result = TryRecv();
+            if (!result && !closed_) {
+                not_empty_.wait(epoch);
+            }
+            recv_waiters_.fetch_sub(1);
+            if (result) {
+                return result;
+            }
+        }
+    }
+
+    template <class... Args>
+    bool TryEmplace(Args&&... args) {
+        size_t pos = send_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos % size_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(2 * pos);
+            if (diff == 0) {
+                if (send_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = send_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        try {
+            new (slot->Get()) T(std::forward<Args>(args)...);
+        } catch (...) {
+            // the slot is claimed and the lap can't move on without it, so
+            // publish it empty for the consumer to skip
+            slot->skipped = true;
+            Publish(slot, pos);
+            throw;
+        }
+        Publish(slot, pos);
+        return true;
+    }
+
+    std::optional<T> TryRecv() {
+        while (true) {
+            size_t pos = recv_pos_.load(std::memory_order_relaxed);
+            Slot* slot;
+            while (true) {
+                slot = &slots_[pos % size_];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(2 * pos + 1);
+                if (diff == 0) {
+                    if (recv_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return std::nullopt;
+                } else {
+                    pos = recv_pos_.load(std::memory_order_relaxed);
+                }
+            }
+            if (slot->skipped) {
+                slot->skipped = false;
+                Free(slot, pos);
+                continue;
+            }
+            // a throwing move loses the value, but still frees the slot
+            std::optional<T> result;
+            try {
+                result.emplace(std::move(*slot->Get()));
+            } catch (...) {
+                slot->Get()->~T();
+                Free(slot, pos);
+                throw;
+            }
+            slot->Get()->~T();
+            Free(slot, pos);
+            return result;
+        }
+    }
+
+    void Close() {
+        closed_ = true;
+        not_full_.fetch_add(1);
+        not_full_.notify_all();
+        not_empty_.fetch_add(1);
+        not_empty_.notify_all();
+    }
+
+private:
+    static constexpr int kSpinCount = 64;
+    static constexpr size_t kCacheLine = 64;
+
+    struct Slot {
+        T* Get() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        std::atomic<size_t> sequence;
+        // set when the constructor threw, ordered by sequence
+        bool skipped = false;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    void Publish(Slot* slot, size_t pos) {
+        slot->sequence.store(2 * pos + 1, std::memory_order_release);
+        Notify(not_empty_, recv_waiters_);
+    }
+
+    void Free(Slot* slot, size_t pos) {
+        slot->sequence.store(2 * (pos + size_), std::memory_order_release);
+        Notify(not_full_, send_waiters_);
+    }
+
+    // Pairs with the fence between registering a waiter and its last try:
+    // either the waiter sees our slot, or we see the waiter.
+    static void Notify(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            epoch.fetch_add(1);
+            epoch.notify_one();
+        }
+    }
+
+    const size_t size_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(kCacheLine) std::atomic<size_t> send_pos_ = 0;
+    alignas(kCacheLine) std::atomic<size_t> recv_pos_ = 0;
+    alignas(kCacheLine) std::atomic<uint32_t> not_full_ = 0;
+    std::atomic<int> send_waiters_ = 0;
+    alignas(kCacheLine) std::atomic<uint32_t> not_empty_ = 0;
+    std::atomic<int> recv_waiters_ = 0;
+    std::atomic_bool closed_ = false;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+#include "epoch.h"
+#include "hazard_pointer.h"
+
+// Reclamation policies for lock-free structures: Guard protects the nodes a
+// thread reads, Retire frees an unlinked node once no guard can see it.
+struct HazardPointerReclaimer {
+    class Guard {
+    public:
+        template <class Node>
+        Node* Protect(const std::atomic<Node*>& src) {
+            return hazard_.Protect(src);
+        }
+
+    private:
+        HazardPointer hazard_;
+    };
+
+    template <class Node>
+    static void Retire(Node* node) {
+        RetireHazard(node);
+    }
+};
+
+struct EpochReclaimer {
+    class Guard {
+    public:
+        template <class Node>
+        Node* Protect(const std::atomic<Node*>& src) {
+            return src.load(std::memory_order_acquire);
+        }
+
+    private:
+        EpochGuard epoch_;
+    };
+
+    template <class Node>
+    static void Retire(Node* node) {
+        RetireEpoch(node);
+    }
+};
+
+// Treiber stack safe for any number of producers and consumers. Pop keeps the
+// head node protected while it reads head->next, and the popped node is
+// retired instead of deleted, so it is neither freed under a concurrent Pop
+// nor reused at the same address while somebody may still CAS on it (ABA).
+template <class T, class Reclaimer = HazardPointerReclaimer>
+class MPMCStack {
+public:
+    MPMCStack() = default;
+
+    MPMCStack(const MPMCStack&) = delete;
+    MPMCStack& operator=(const MPMCStack&) = delete;
+
+    // Not safe to call concurrently with other methods
+    ~MPMCStack() {
+        Node* node = head_.load(std::memory_order_relaxed);
+        while (node) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // Push adds one element to stack top.
+    //
+    // Safe to call from multiple threads.
+    void Push(const T& value) {
+        Emplace(value);
+    }
+
+    void Push(T&& value) {
+        Emplace(std::move(value));
+    }
+
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        Node* node = new Node{T(std::forward<Args>(args)...), head_.load(std::memory_order_relaxed)};
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    // Pop removes top element from the stack.
+    //
+    // Safe to call from multiple threads.
+    std::optional<T> Pop() {
+        typename Reclaimer::Guard guard;
+        while (true) {
+            Node* head = guard.Protect(head_);
+            if (!head) {
+                return std::nullopt;
+            }
+            if (head_.compare_exchange_weak(head, head->next, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                std::optional<T> result(std::move(head->value));
+                Reclaimer::Retire(head);
+                return result;
+            }
+        }
+    }
+
+    bool IsEmpty() const {
+        return !head_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+
+    std::atomic<Node*> head_ = nullptr;
+};
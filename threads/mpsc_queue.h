@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+template <class T>
+class MPSCQueue;
+
+// Objects pushed into MPSCQueue derive from MPSCQueueHook. One object may be
+// in at most one queue at a time.
+class MPSCQueueHook {
+public:
+    MPSCQueueHook() = default;
+    MPSCQueueHook(const MPSCQueueHook&) = delete;
+    MPSCQueueHook& operator=(const MPSCQueueHook&) = delete;
+
+private:
+    template <class T>
+    friend class MPSCQueue;
+
+    std::atomic<MPSCQueueHook*> next_ = nullptr;
+};
+
+// Intrusive FIFO queue after Dmitry Vyukov's non-intrusive MPSC node-based
+// queue. Producers link the element they own, so Push is a single exchange:
+// wait-free and allocation-free. Queue never owns elements.
+template <class T>
+class MPSCQueue {
+public:
+    MPSCQueue() : head_(&stub_), tail_(&stub_) {
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // Push adds elem to the queue tail.
+    //
+    // Safe to call from multiple threads.
+    void Push(T* elem) {
+        PushHook(elem);
+    }
+
+    // Pop removes element from the queue head, returns nullptr if queue is
+    // empty. May also return nullptr while a concurrent Push is half done,
+    // the element becomes visible as soon as that Push returns.
+    //
+    // Not safe to call concurrently.
+    T* Pop() {
+        MPSCQueueHook* tail = tail_;
+        MPSCQueueHook* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        // tail is the last element, put stub behind it so it can be detached
+        PushHook(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+    // DequeueAll Pop's all elements from the queue in FIFO order and calls cb() for each.
+    //
+    // Not safe to call concurrently with Pop()
+    template <class TFn>
+    void DequeueAll(const TFn& cb) {
+        while (T* elem = Pop()) {
+            cb(elem);
+        }
+    }
+
+private:
+    void PushHook(MPSCQueueHook* hook) {
+        hook->next_.store(nullptr, std::memory_order_relaxed);
+        MPSCQueueHook* prev = head_.exchange(hook, std::memory_order_acq_rel);
+        prev->next_.store(hook, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    // producers and consumer touch different cache lines
+    alignas(kCacheLine) std::atomic<MPSCQueueHook*> head_;
+    alignas(kCacheLine) MPSCQueueHook* tail_;
+    MPSCQueueHook stub_;
+};
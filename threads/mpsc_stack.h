@@ -1,10 +1,20 @@
 #pragma once
 
 #include <atomic>
+#include <new>
 #include <optional>
 #include <stdexcept>
 #include <utility>
 
+#include "node_pool.h"
+
+enum class DrainOrder {
+    kLifo,  // newest first, as the stack holds them
+    kFifo,  // oldest first, in push order
+};
+
+// Nodes come from a NodePool with per-thread free lists, so steady-state Push
+// and Pop don't call malloc.
 template <class T>
 class MPSCStack {
 public:
@@ -12,40 +22,44 @@ public:
     //
     // Safe to call from multiple threads.
     void Push(const T& value) {
-        Node* old_head = head_;
-        Node* new_head = new Node{.value = value, .next = old_head};
-        while (!head_.compare_exchange_weak(old_head, new_head)) {
+        Node* new_head = NewNode(value);
+        Node* old_head = head_.load(std::memory_order_relaxed);
+        do {
             new_head->next = old_head;
-        }
+        } while (!head_.compare_exchange_weak(old_head, new_head, std::memory_order_release,
+                                              std::memory_order_relaxed));
     }
 
     // Pop removes top element from the stack.
     //
     // Not safe to call concurrently.
     std::optional<T> Pop() {
-        Node* old_head = head_;
+        Node* old_head = head_.load(std::memory_order_acquire);
         if (!old_head) {
             return std::nullopt;
         }
-        while (!head_.compare_exchange_weak(old_head, old_head->next)) {
+        while (!head_.compare_exchange_weak(old_head, old_head->next, std::memory_order_acquire)) {
         }
         std::optional<T> result = std::move(old_head->value);
-        delete old_head;
+        DeleteNode(old_head);
         return result;
     }
 
-    // DequeuedAll Pop's all elements from the stack and calls cb() for each.
+    // DequeueAll detaches the whole stack with one exchange and calls cb() for
+    // each element, newest first by default or in push order with kFifo.
     //
     // Not safe to call concurrently with Pop()
     template <class TFn>
-    void DequeueAll(const TFn& cb) {
-        Node* old_head = head_;
-        while (old_head) {
-            while (!head_.compare_exchange_weak(old_head, old_head->next)) {
-            }
-            cb(old_head->value);
-            delete old_head;
-            old_head = head_;
+    void DequeueAll(const TFn& cb, DrainOrder order = DrainOrder::kLifo) {
+        Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+        if (order == DrainOrder::kFifo) {
+            node = Reverse(node);
+        }
+        while (node) {
+            Node* next = node->next;
+            cb(node->value);
+            DeleteNode(node);
+            node = next;
         }
     }
 
@@ -59,6 +73,34 @@ private:
         Node* next;
     };
 
+    using Pool = NodePool<Node>;
+
+    static Node* NewNode(const T& value) {
+        void* memory = Pool::Allocate();
+        try {
+            return new (memory) Node{.value = value, .next = nullptr};
+        } catch (...) {
+            Pool::Deallocate(memory);
+            throw;
+        }
+    }
+
+    static void DeleteNode(Node* node) {
+        node->~Node();
+        Pool::Deallocate(node);
+    }
+
+    static Node* Reverse(Node* node) {
+        Node* reversed = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        return reversed;
+    }
+
 private:
-    std::atomic<Node*> head_;
+    std::atomic<Node*> head_ = nullptr;
 };
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Pool of fixed-size blocks with a free list per thread. Allocate and
+// Deallocate touch only the thread-local list; blocks move between threads
+// through a global list of batches, so a producer allocating on one thread and
+// a consumer freeing on another pay for the mutex once per kBatchSize blocks.
+// Blocks are never returned to the system while the program runs. Pool stays
+// usable during exit: a thread whose cache is already destroyed falls back
+// to the global heap.
+template <size_t Size, size_t Align = alignof(std::max_align_t)>
+class FixedSizePool {
+public:
+    static void* Allocate() {
+        ThreadCache* cache = Cache();
+        if (cache && !cache->head) {
+            cache->Refill();
+        }
+        if (!cache || !cache->head) {
+            return ::operator new(kBlockSize, std::align_val_t(kBlockAlign));
+        }
+        FreeBlock* block = cache->head;
+        cache->head = block->next;
+        --cache->count;
+        return block;
+    }
+
+    static void Deallocate(void* ptr) {
+        ThreadCache* cache = Cache();
+        if (!cache) {
+            ::operator delete(ptr, std::align_val_t(kBlockAlign));
+            return;
+        }
+        cache->head = new (ptr) FreeBlock{cache->head};
+        if (++cache->count >= 2 * kBatchSize) {
+            cache->Flush(kBatchSize);
+        }
+    }
+
+private:
+    static constexpr size_t kBatchSize = 64;
+    static constexpr size_t kBlockAlign = std::max(Align, alignof(void*));
+    static constexpr size_t kBlockSize =
+        (std::max(Size, sizeof(void*)) + kBlockAlign - 1) / kBlockAlign * kBlockAlign;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Batch {
+        FreeBlock* head;
+        size_t count;
+    };
+
+    // Full batches given up by threads
+    struct Global {
+        std::mutex mutex;
+        std::vector<Batch> batches;
+    };
+
+    struct ThreadCache {
+        ~ThreadCache() {
+            Flush(count);
+            CacheDestroyed() = true;
+        }
+
+        void Refill() {
+            Global& global = GetGlobal();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            if (global.batches.empty()) {
+                return;
+            }
+            head = global.batches.back().head;
+            count = global.batches.back().count;
+            global.batches.pop_back();
+        }
+
+        // Moves first n blocks of the list to the global pool
+        void Flush(size_t n) {
+            if (n == 0) {
+                return;
+            }
+            Batch batch{head, n};
+            FreeBlock* last = head;
+            for (size_t i = 1; i < n; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            count -= n;
+            Global& global = GetGlobal();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            global.batches.push_back(batch);
+        }
+
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+    };
+
+    // Never destroyed, so blocks may be freed from other static destructors
+    static Global& GetGlobal() {
+        static Global* global = new Global;
+        return *global;
+    }
+
+    static bool& CacheDestroyed() {
+        static thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    // Returns nullptr once the cache of current thread is destroyed
+    static ThreadCache* Cache() {
+        if (CacheDestroyed()) {
+            return nullptr;
+        }
+        static thread_local ThreadCache cache;
+        return &cache;
+    }
+};
+
+template <class T>
+using NodePool = FixedSizePool<sizeof(T), alignof(T)>;
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "backoff.h"
+
+// Global parking lot after WebKit's WTF::ParkingLot. Threads park on an
+// arbitrary address in a fixed table of buckets hashed by that address, so
+// a lock or condition needs only a byte of its own: all wait queues and
+// per-thread wakeup machinery live here.
+namespace parking_lot {
+
+using Clock = std::chrono::steady_clock;
+
+struct ParkResult {
+    bool unparked = false;
+    uintptr_t token = 0;
+};
+
+struct UnparkResult {
+    bool unparked = false;
+    // more threads are still parked on the same address
+    bool have_more = false;
+};
+
+namespace detail {
+
+inline constexpr size_t kBucketBits = 9;
+inline constexpr size_t kBucketCount = size_t{1} << kBucketBits;
+
+struct ThreadData {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool unparked = false;
+    uintptr_t token = 0;
+    const void* address = nullptr;
+    ThreadData* next = nullptr;
+};
+
+struct alignas(64) Bucket {
+    // Removes first thread parked on address, or every such thread if all
+    // is set. Returns removed threads linked through next.
+    ThreadData* Dequeue(const void* address, bool all, bool* have_more) {
+        ThreadData* result = nullptr;
+        ThreadData** result_tail = &result;
+        ThreadData* prev = nullptr;
+        *have_more = false;
+        for (ThreadData* now = head; now;) {
+            ThreadData* next = now->next;
+            if (now->address != address) {
+                prev = now;
+            } else if (result && !all) {
+                *have_more = true;
+                break;
+            } else {
+                Unlink(prev, now);
+                *result_tail = now;
+                result_tail = &now->next;
+                now->next = nullptr;
+            }
+            now = next;
+        }
+        return result;
+    }
+
+    void Enqueue(ThreadData* thread) {
+        thread->next = nullptr;
+        if (tail) {
+            tail->next = thread;
+        } else {
+            head = thread;
+        }
+        tail = thread;
+    }
+
+    bool Remove(ThreadData* thread) {
+        ThreadData* prev = nullptr;
+        for (ThreadData* now = head; now; prev = now, now = now->next) {
+            if (now == thread) {
+                Unlink(prev, now);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Unlink(ThreadData* prev, ThreadData* thread) {
+        (prev ? prev->next : head) = thread->next;
+        if (tail == thread) {
+            tail = prev;
+        }
+    }
+
+    std::mutex mutex;
+    ThreadData* head = nullptr;
+    ThreadData* tail = nullptr;
+};
+
+inline Bucket buckets[kBucketCount];
+
+inline Bucket& BucketFor(const void* address) {
+    uint64_t key = reinterpret_cast<uintptr_t>(address);
+    return buckets[(key * 0x9E3779B97F4A7C15) >> (64 - kBucketBits)];
+}
+
+inline ThreadData& CurrentThread() {
+    static thread_local ThreadData data;
+    return data;
+}
+
+inline void Wake(ThreadData* thread, uintptr_t token) {
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    thread->token = token;
+    thread->unparked = true;
+    thread->cv.notify_one();
+}
+
+}  // namespace detail
+
+// Parks current thread on address if validate() returns true. validate runs
+// under the bucket lock, before_sleep runs after the thread is queued, so a
+// caller can release its own lock there without losing a wakeup. Returns
+// after an Unpark call for this address or once deadline passes.
+template <class Validate, class BeforeSleep>
+ParkResult Park(const void* address, Validate validate, BeforeSleep before_sleep,
+                std::optional<Clock::time_point> deadline = std::nullopt) {
+    detail::ThreadData& self = detail::CurrentThread();
+    detail::Bucket& bucket = detail::BucketFor(address);
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+        if (!validate()) {
+            return {};
+        }
+        self.address = address;
+        self.unparked = false;
+        bucket.Enqueue(&self);
+    }
+    before_sleep();
+
+    std::unique_lock<std::mutex> lock(self.mutex);
+    if (!deadline) {
+        self.cv.wait(lock, [&] { return self.unparked; });
+        return {true, self.token};
+    }
+    if (self.cv.wait_until(lock, *deadline, [&] { return self.unparked; })) {
+        return {true, self.token};
+    }
+    lock.unlock();
+    {
+        std::lock_guard<std::mutex> bucket_lock(bucket.mutex);
+        if (bucket.Remove(&self)) {
+            return {};
+        }
+    }
+    // somebody has already dequeued us and is about to wake us up
+    lock.lock();
+    self.cv.wait(lock, [&] { return self.unparked; });
+    return {true, self.token};
+}
+
+template <class Validate>
+ParkResult Park(const void* address, Validate validate,
+                std::optional<Clock::time_point> deadline = std::nullopt) {
+    return Park(address, std::move(validate), [] {}, deadline);
+}
+
+// Unparks the longest parked thread on address. callback(UnparkResult) runs
+// under the bucket lock, even if nobody was parked, and returns the token
+// passed to the woken thread.
+template <class Callback>
+UnparkResult UnparkOne(const void* address, Callback callback) {
+    detail::Bucket& bucket = detail::BucketFor(address);
+    UnparkResult result;
+    detail::ThreadData* thread;
+    uintptr_t token;
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+        thread = bucket.Dequeue(address, false, &result.have_more);
+        result.unparked = thread != nullptr;
+        token = callback(result);
+    }
+    if (thread) {
+        detail::Wake(thread, token);
+    }
+    return result;
+}
+
+inline UnparkResult UnparkOne(const void* address) {
+    return UnparkOne(address, [](UnparkResult) -> uintptr_t { return 0; });
+}
+
+// Returns number of unparked threads
+inline size_t UnparkAll(const void* address) {
+    detail::Bucket& bucket = detail::BucketFor(address);
+    detail::ThreadData* threads;
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+        bool have_more;
+        threads = bucket.Dequeue(address, true, &have_more);
+    }
+    size_t count = 0;
+    while (threads) {
+        // thread may park again as soon as it is woken up
+        detail::ThreadData* next = threads->next;
+        detail::Wake(threads, 0);
+        threads = next;
+        ++count;
+    }
+    return count;
+}
+
+}  // namespace parking_lot
+
+// One byte mutex: bit 0 means locked, bit 1 means somebody is parked. Lock
+// spins with backoff while nobody is parked, then parks. Satisfies Lockable,
+// so works with std::lock_guard and std::unique_lock.
+class ParkingMutex {
+public:
+    void lock() {  // NOLINT
+        uint8_t expected = 0;
+        if (!state_.compare_exchange_weak(expected, kLocked, std::memory_order_acquire,
+                                          std::memory_order_relaxed)) {
+            LockSlow();
+        }
+    }
+
+    bool try_lock() {  // NOLINT
+        uint8_t state = state_.load(std::memory_order_relaxed);
+        while (!(state & kLocked)) {
+            if (state_.compare_exchange_weak(state, state | kLocked, std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void unlock() {  // NOLINT
+        uint8_t expected = kLocked;
+        if (!state_.compare_exchange_strong(expected, 0, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+            UnlockSlow();
+        }
+    }
+
+private:
+    static constexpr uint8_t kLocked = 1;
+    static constexpr uint8_t kParked = 2;
+
+    void LockSlow() {
+        SpinBackoff backoff;
+        while (true) {
+            uint8_t state = state_.load(std::memory_order_relaxed);
+            if (!(state & kLocked)) {
+                if (state_.compare_exchange_weak(state, state | kLocked, std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            if (!(state & kParked)) {
+                if (backoff.IsSpinning()) {
+                    backoff.Pause();
+                    continue;
+                }
+                if (!state_.compare_exchange_weak(state, state | kParked, std::memory_order_relaxed)) {
+                    continue;
+                }
+            }
+            parking_lot::Park(this, [&] {
+                return state_.load(std::memory_order_relaxed) == (kLocked | kParked);
+            });
+            backoff.Reset();
+        }
+    }
+
+    // Parked bit stays set while someone is left in the queue
+    void UnlockSlow() {
+        parking_lot::UnparkOne(this, [&](parking_lot::UnparkResult result) -> uintptr_t {
+            state_.store(result.have_more ? kParked : 0, std::memory_order_release);
+            return 0;
+        });
+    }
+
+    std::atomic<uint8_t> state_ = 0;
+};
+
+// One byte condition variable for any Lockable (ParkingMutex in particular).
+// Waiter is queued before it releases the lock, so notifying after the state
+// change under the same lock never loses a wakeup.
+class ParkingCondition {
+public:
+    template <class Lock>
+    void Wait(Lock& lock) {
+        WaitUntil(lock, std::nullopt);
+    }
+
+    template <class Lock, class Predicate>
+    void Wait(Lock& lock, Predicate predicate) {
+        while (!predicate()) {
+            Wait(lock);
+        }
+    }
+
+    // Returns false if deadline passed without notification
+    template <class Lock>
+    bool WaitUntil(Lock& lock, std::optional<parking_lot::Clock::time_point> deadline) {
+        parking_lot::ParkResult result = parking_lot::Park(
+            this,
+            [&] {
+                has_waiters_.store(true, std::memory_order_relaxed);
+                return true;
+            },
+            [&] { lock.unlock(); }, deadline);
+        lock.lock();
+        return result.unparked;
+    }
+
+    void NotifyOne() {
+        if (!has_waiters_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        parking_lot::UnparkOne(this, [&](parking_lot::UnparkResult result) -> uintptr_t {
+            has_waiters_.store(result.have_more, std::memory_order_relaxed);
+            return 0;
+        });
+    }
+
+    void NotifyAll() {
+        if (!has_waiters_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        has_waiters_.store(false, std::memory_order_relaxed);
+        parking_lot::UnparkAll(this);
+    }
+
+private:
+    std::atomic<bool> has_waiters_ = false;
+};
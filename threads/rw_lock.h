@@ -1,14 +1,21 @@
 #pragma once
-#include <condition_variable>
 #include <memory>
 #include <mutex>
 
+#include "instrumentation.h"
+#include "parking_lot.h"
+
 class RWLock {
 public:
     template <class Func>
     void Read(Func func) {
-        std::unique_lock<std::mutex> lock{global_};
+        std::unique_lock<ParkingMutex> lock{global_, std::try_to_lock};
+        if (!lock) {
+            [[maybe_unused]] auto timer = read_stats_.Blocked();
+            lock.lock();
+        }
         ++blocked_readers_;
+        read_stats_.OnAcquire();
         lock.unlock();
         try {
             func();
@@ -21,20 +28,37 @@ public:
 
     template <class Func>
     void Write(Func func) {
-        std::unique_lock lock(global_);
-        while (blocked_readers_) {
-            cv_.wait(lock);
+        std::unique_lock lock(global_, std::try_to_lock);
+        if (!lock || blocked_readers_) {
+            [[maybe_unused]] auto timer = write_stats_.Blocked();
+            if (!lock) {
+                lock.lock();
+            }
+            while (blocked_readers_) {
+                cv_.Wait(lock);
+            }
         }
+        write_stats_.OnAcquire();
         func();
     }
 
+    const LockStats& GetReadStats() const {
+        return read_stats_;
+    }
+
+    const LockStats& GetWriteStats() const {
+        return write_stats_;
+    }
+
 private:
-    std::mutex global_;
-    std::condition_variable cv_;
+    ParkingMutex global_;
+    ParkingCondition cv_;
     int blocked_readers_ = 0;
+    [[no_unique_address]] LockStats read_stats_;
+    [[no_unique_address]] LockStats write_stats_;
     void End(bool all) {
         std::lock_guard lock{global_};
         --blocked_readers_;
-        cv_.notify_all();
+        cv_.NotifyAll();
     }
 };
\ No newline at end of file
@@ -1,43 +1,61 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 
+#include "backoff.h"
+
+// Bit 0 is set while writer holds the lock, bit 1 while some writer waits for
+// it, readers are counted from bit 2. Waiting writer blocks new readers, so a
+// stream of readers can't starve it.
 struct RWSpinLock {
+    static constexpr uint32_t kWriter = 1;
+    static constexpr uint32_t kWriterIntent = 2;
+    static constexpr uint32_t kReader = 4;
+
     void LockRead() {
-        uint32_t old = counter;
+        SpinBackoff backoff;
+        uint32_t old = counter.load(std::memory_order_relaxed);
         while (true) {
-            if (old & 1) {
-                old = counter;
+            if (old & (kWriter | kWriterIntent)) {
+                backoff.Pause();
+                old = counter.load(std::memory_order_relaxed);
                 continue;
             }
-            if (!counter.compare_exchange_weak(old, old + 2)) {
-                continue;
+            if (counter.compare_exchange_weak(old, old + kReader, std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                break;
             }
-            break;
         }
     }
 
     void UnlockRead() {
-        counter -= 2;
+        counter.fetch_sub(kReader, std::memory_order_release);
     }
 
+    // Acquiring clears the intent bit, other waiting writers set it again
     void LockWrite() {
-        uint32_t old = counter;
+        SpinBackoff backoff;
+        uint32_t old = counter.load(std::memory_order_relaxed);
         while (true) {
-            if (old != 0) {
-                old = counter;
+            if ((old & ~kWriterIntent) == 0) {
+                if (counter.compare_exchange_weak(old, kWriter, std::memory_order_acquire,
+                                                  std::memory_order_relaxed)) {
+                    break;
+                }
                 continue;
             }
-            if (!counter.compare_exchange_weak(old, old + 1)) {
-                continue;
+            if (!(old & kWriterIntent)) {
+                counter.fetch_or(kWriterIntent, std::memory_order_relaxed);
             }
-            break;
+            backoff.Pause();
+            old = counter.load(std::memory_order_relaxed);
         }
     }
 
     void UnlockWrite() {
-        counter--;
+        counter.fetch_and(~kWriter, std::memory_order_release);
     }
 
-    std::atomic_uint32_t counter;
+    std::atomic_uint32_t counter = 0;
 };
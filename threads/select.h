@@ -0,0 +1,432 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <utility>
+
+struct SelectCaseHook;
+
+// Wakes up a blocked Select. One waiter is shared by all cases of a Select.
+// Whoever fires a case of a blocked Select claims its waiter first, under
+// the channel mutex, so exactly one case fires.
+class SelectWaiter {
+public:
+    void Notify() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            notified_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        notified_ = false;
+    }
+
+    // Returns false if the Select has already been claimed, hook is the
+    // case that fires (nullptr for the deadline)
+    bool Claim(SelectCaseHook* hook) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (claimed_) {
+            return false;
+        }
+        claimed_ = true;
+        fired_ = hook;
+        return true;
+    }
+
+    bool IsClaimed() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return claimed_;
+    }
+
+    SelectCaseHook* Fired() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fired_;
+    }
+
+    // Claims both waiters or none of them
+    static bool ClaimPair(SelectWaiter* first, SelectCaseHook* first_hook, SelectWaiter* second,
+                          SelectCaseHook* second_hook) {
+        std::scoped_lock lock(first->mutex_, second->mutex_);
+        if (first->claimed_ || second->claimed_) {
+            return false;
+        }
+        first->claimed_ = second->claimed_ = true;
+        first->fired_ = first_hook;
+        second->fired_ = second_hook;
+        return true;
+    }
+
+    // Returns false if deadline has passed without notification
+    template <class TimePoint>
+    bool WaitUntil(const std::optional<TimePoint>& deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!deadline) {
+            cv_.wait(lock, [this] { return notified_; });
+            return true;
+        }
+        return cv_.wait_until(lock, *deadline, [this] { return notified_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool notified_ = false;
+    bool claimed_ = false;
+    SelectCaseHook* fired_ = nullptr;
+};
+
+// Every channel case of a Select links one hook into its channel. Through
+// value a Select on the other end of the channel completes the case for it:
+// send cases point to const T, receive cases to std::optional<T>.
+struct SelectCaseHook {
+    SelectWaiter* waiter = nullptr;
+    void* value = nullptr;
+    bool send = false;
+    SelectCaseHook* prev = nullptr;
+    SelectCaseHook* next = nullptr;
+};
+
+// Claims the Select of self, if it is blocked, before its case fires.
+// Returns false if some other case of it has already fired.
+inline bool ClaimSelectCase(SelectCaseHook* self) {
+    return !self || !self->waiter || self->waiter->Claim(self);
+}
+
+// List of Select-s blocked on a channel. Guarded by the channel mutex.
+class SelectWaiterList {
+public:
+    void Add(SelectCaseHook* hook) {
+        hook->prev = nullptr;
+        hook->next = head_;
+        if (head_) {
+            head_->prev = hook;
+        }
+        head_ = hook;
+    }
+
+    void Remove(SelectCaseHook* hook) {
+        if (hook->prev) {
+            hook->prev->next = hook->next;
+        } else {
+            head_ = hook->next;
+        }
+        if (hook->next) {
+            hook->next->prev = hook->prev;
+        }
+    }
+
+    // Claims the first blocked Select with a case of the opposite kind
+    // (send = true looks for send cases) together with the Select of self.
+    // Returns its hook, or nullptr if there is none or self is already
+    // claimed. Caller completes the peer case and notifies it.
+    SelectCaseHook* ClaimPeer(SelectCaseHook* self, bool send) {
+        SelectWaiter* own = self ? self->waiter : nullptr;
+        for (SelectCaseHook* now = head_; now; now = now->next) {
+            if (now->send != send || now->waiter == own) {
+                continue;
+            }
+            bool claimed = own ? SelectWaiter::ClaimPair(own, self, now->waiter, now)
+                               : now->waiter->Claim(now);
+            if (claimed) {
+                return now;
+            }
+            if (own && own->IsClaimed()) {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Called on every channel state change
+    void NotifyAll() {
+        for (SelectCaseHook* now = head_; now; now = now->next) {
+            now->waiter->Notify();
+        }
+    }
+
+private:
+    SelectCaseHook* head_ = nullptr;
+};
+
+// func(std::optional<T>) is called with the received value, or with
+// std::nullopt if channel is closed.
+template <class Channel, class Func>
+class RecvCase {
+public:
+    RecvCase(Channel& channel, Func func) : channel_(channel), func_(std::move(func)) {
+    }
+
+    bool Poll() {
+        std::optional<typename Channel::ValueType> value;
+        if (!channel_.PollRecv(value, &hook_)) {
+            return false;
+        }
+        func_(std::move(value));
+        return true;
+    }
+
+    void Register(SelectWaiter* waiter) {
+        hook_.waiter = waiter;
+        hook_.value = &received_;
+        channel_.AddSelectWaiter(&hook_);
+    }
+
+    void Unregister() {
+        channel_.RemoveSelectWaiter(&hook_);
+        hook_.waiter = nullptr;
+    }
+
+    // Runs func if a sender has completed this case while Select was blocked
+    bool Finish(const SelectCaseHook* fired) {
+        if (fired != &hook_) {
+            return false;
+        }
+        func_(std::move(received_));
+        return true;
+    }
+
+private:
+    Channel& channel_;
+    Func func_;
+    std::optional<typename Channel::ValueType> received_;
+    SelectCaseHook hook_;
+};
+
+// func() is called after value is sent. Sending to a closed channel throws,
+// same as Send.
+template <class Channel, class Func>
+class SendCase {
+public:
+    SendCase(Channel& channel, typename Channel::ValueType value, Func func)
+        : channel_(channel), value_(std::move(value)), func_(std::move(func)) {
+    }
+
+    bool Poll() {
+        if (!channel_.PollSend(value_, &hook_)) {
+            return false;
+        }
+        func_();
+        return true;
+    }
+
+    void Register(SelectWaiter* waiter) {
+        hook_.waiter = waiter;
+        hook_.value = &value_;
+        hook_.send = true;
+        channel_.AddSelectWaiter(&hook_);
+    }
+
+    void Unregister() {
+        channel_.RemoveSelectWaiter(&hook_);
+        hook_.waiter = nullptr;
+    }
+
+    // Runs func if a receiver has taken the value while Select was blocked
+    bool Finish(const SelectCaseHook* fired) {
+        if (fired != &hook_) {
+            return false;
+        }
+        func_();
+        return true;
+    }
+
+private:
+    Channel& channel_;
+    typename Channel::ValueType value_;
+    Func func_;
+    SelectCaseHook hook_;
+};
+
+// Runs when no channel case is ready right away
+template <class Func>
+class DefaultCase {
+public:
+    explicit DefaultCase(Func func) : func_(std::move(func)) {
+    }
+
+    void Run() {
+        func_();
+    }
+
+private:
+    Func func_;
+};
+
+// Runs when no channel case became ready before deadline
+template <class Func>
+class DeadlineCase {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    DeadlineCase(Clock::time_point deadline, Func func) : deadline_(deadline), func_(std::move(func)) {
+    }
+
+    DeadlineCase(Clock::duration timeout, Func func)
+        : deadline_(Clock::now() + timeout), func_(std::move(func)) {
+    }
+
+    Clock::time_point GetDeadline() const {
+        return deadline_;
+    }
+
+    void Run() {
+        func_();
+    }
+
+private:
+    Clock::time_point deadline_;
+    Func func_;
+};
+
+namespace select_detail {
+
+template <class Case>
+concept ChannelCase = requires(Case c) { c.Poll(); };
+
+template <class Case>
+concept TimedCase = requires(Case c) { c.GetDeadline(); };
+
+template <class Tuple, size_t... Is>
+bool PollCase(Tuple& cases, size_t index, std::index_sequence<Is...>) {
+    bool fired = false;
+    (
+        [&] {
+            if constexpr (ChannelCase<std::tuple_element_t<Is, Tuple>>) {
+                if (index == Is) {
+                    fired = std::get<Is>(cases).Poll();
+                }
+            }
+        }(),
+        ...);
+    return fired;
+}
+
+}  // namespace select_detail
+
+// Select blocks until one of the channel cases can proceed and runs it.
+// Ready cases are polled in random order, so none of them starves. With a
+// DefaultCase Select never blocks, with a DeadlineCase it blocks until the
+// deadline. Returns index of the case that was run.
+//
+// While blocked, Select has one waiter linked into every channel and sleeps
+// until some channel changes its state. A Select polling an unbuffered
+// channel may also complete a case of another Select blocked on its other
+// end, so Select-s meet each other as well as plain Send and Recv.
+template <class... Cases>
+size_t Select(Cases&&... cases) {
+    constexpr size_t kCount = sizeof...(Cases);
+    using Tuple = std::tuple<std::remove_reference_t<Cases>&...>;
+    using Sequence = std::index_sequence_for<Cases...>;
+    Tuple tuple(cases...);
+
+    std::optional<size_t> default_index;
+    std::optional<size_t> deadline_index;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    size_t index = 0;
+    (
+        [&] {
+            using Case = std::remove_reference_t<Cases>;
+            if constexpr (select_detail::TimedCase<Case>) {
+                deadline_index = index;
+                deadline = cases.GetDeadline();
+            } else if constexpr (!select_detail::ChannelCase<Case>) {
+                default_index = index;
+            }
+            ++index;
+        }(),
+        ...);
+
+    static thread_local std::minstd_rand random{std::random_device{}()};
+    std::array<size_t, kCount> order;
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), random);
+
+    auto poll = [&]() -> std::optional<size_t> {
+        for (size_t i : order) {
+            if (select_detail::PollCase(tuple, i, Sequence{})) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    };
+    auto run = [&](size_t target) {
+        size_t i = 0;
+        (
+            [&] {
+                if constexpr (!select_detail::ChannelCase<std::remove_reference_t<Cases>>) {
+                    if (i == target) {
+                        cases.Run();
+                    }
+                }
+                ++i;
+            }(),
+            ...);
+        return target;
+    };
+    auto for_each_channel = [&](auto action) {
+        (
+            [&] {
+                if constexpr (select_detail::ChannelCase<std::remove_reference_t<Cases>>) {
+                    action(cases);
+                }
+            }(),
+            ...);
+    };
+
+    if (auto fired = poll()) {
+        return *fired;
+    }
+    if (default_index) {
+        return run(*default_index);
+    }
+
+    SelectWaiter waiter;
+    for_each_channel([&](auto& c) { c.Register(&waiter); });
+    std::optional<size_t> fired;
+    try {
+        while (true) {
+            waiter.Reset();
+            fired = poll();
+            if (fired || waiter.IsClaimed() || !waiter.WaitUntil(deadline)) {
+                break;
+            }
+        }
+    } catch (...) {
+        for_each_channel([](auto& c) { c.Unregister(); });
+        throw;
+    }
+    // a peer may still claim a case until the deadline claims the Select
+    bool timed_out = !fired && waiter.Claim(nullptr);
+    for_each_channel([](auto& c) { c.Unregister(); });
+    if (fired) {
+        return *fired;
+    }
+    if (timed_out) {
+        return run(*deadline_index);
+    }
+    // a Select on the other end has completed one of our cases
+    SelectCaseHook* hook = waiter.Fired();
+    size_t i = 0;
+    (
+        [&] {
+            if constexpr (select_detail::ChannelCase<std::remove_reference_t<Cases>>) {
+                if (cases.Finish(hook)) {
+                    fired = i;
+                }
+            }
+            ++i;
+        }(),
+        ...);
+    return *fired;
+}
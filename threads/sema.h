@@ -1,8 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <concepts>
 #include <mutex>
-#include <condition_variable>
-#include <set>
+#include <optional>
+
+#include "../data_structures/intrusive_list.h"
+#include "instrumentation.h"
+#include "parking_lot.h"
 
 class DefaultCallback {
 public:
@@ -11,37 +17,123 @@ public:
     }
 };
 
+// Fair semaphore. Blocked Enter-s wait in a FIFO queue, each parked on its
+// own record in the global parking lot, and Leave hands permits straight to
+// the waiters at the head of the queue, waking only those that got their
+// permits. Woken waiter doesn't touch the mutex again. A newcomer never
+// overtakes a queued waiter, so a heavy Enter(n) is not starved by light ones.
 class Semaphore {
 public:
     Semaphore(int count) : count_(count) {
     }
 
-    void Leave() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        ++count_;
-        cv_.notify_all();
+    void Leave(int count = 1) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        count_ += count;
+        Grant();
+    }
+
+    void Enter(int count = 1) {
+        std::unique_lock<ParkingMutex> lock(mutex_);
+        Acquire(lock, count, std::nullopt);
     }
 
+    // Waits for one permit, then calls callback(count) with the permit still
+    // in count, callback decides how much to take.
     template <class Func>
+        requires std::invocable<Func&, int&>
     void Enter(Func callback) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        int my_id = new_index_++;
-        while (count_ == 0 || next_index_ != my_id) {
-            cv_.wait(lock);
+        std::unique_lock<ParkingMutex> lock(mutex_);
+        Acquire(lock, 1, std::nullopt);
+        if (!lock.owns_lock()) {
+            lock.lock();
         }
-        ++next_index_;
+        ++count_;
         callback(count_);
+        Grant();
+    }
+
+    bool TryEnter(int count = 1) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        if (!queue_.IsEmpty() || count_ < count) {
+            return false;
+        }
+        count_ -= count;
+        stats_.OnAcquire();
+        return true;
+    }
+
+    // Returns false if permits were not granted before deadline
+    template <class Clock, class Duration>
+    bool TryEnterUntil(const std::chrono::time_point<Clock, Duration>& deadline, int count = 1) {
+        auto timeout = std::chrono::duration_cast<parking_lot::Clock::duration>(deadline - Clock::now());
+        std::unique_lock<ParkingMutex> lock(mutex_);
+        return Acquire(lock, count, parking_lot::Clock::now() + timeout);
+    }
+
+    template <class Rep, class Period>
+    bool TryEnterFor(const std::chrono::duration<Rep, Period>& timeout, int count = 1) {
+        return TryEnterUntil(std::chrono::steady_clock::now() + timeout, count);
     }
 
-    void Enter() {
-        DefaultCallback callback;
-        Enter(callback);
+    const LockStats& GetStats() const {
+        return stats_;
     }
 
 private:
-    std::mutex mutex_;
-    std::condition_variable cv_;
+    struct Waiter : public ListHook {
+        explicit Waiter(int count) : count(count) {
+        }
+
+        int count;
+        std::atomic<bool> granted = false;
+    };
+
+    // Returns with lock released if the caller had to park
+    bool Acquire(std::unique_lock<ParkingMutex>& lock, int count,
+                 std::optional<parking_lot::Clock::time_point> deadline) {
+        if (queue_.IsEmpty() && count_ >= count) {
+            count_ -= count;
+            stats_.OnAcquire();
+            return true;
+        }
+        [[maybe_unused]] auto timer = stats_.Blocked();
+        Waiter self(count);
+        queue_.PushBack(&self);
+        stats_.OnWaiters(++waiters_);
+        parking_lot::ParkResult result = parking_lot::Park(
+            &self, [&] { return !self.granted.load(std::memory_order_relaxed); },
+            [&] { lock.unlock(); }, deadline);
+        if (!result.unparked) {
+            lock.lock();
+            if (!self.granted.load(std::memory_order_relaxed)) {
+                self.Unlink();
+                stats_.OnWaiters(--waiters_);
+                // permits may be enough for whoever is behind us
+                Grant();
+                return false;
+            }
+        }
+        stats_.OnAcquire();
+        return true;
+    }
+
+    // Called under mutex_, so a waiter whose deadline passes meanwhile
+    // still finds granted set once it gets the mutex.
+    void Grant() {
+        while (!queue_.IsEmpty() && count_ >= queue_.Front().count) {
+            Waiter& waiter = queue_.Front();
+            queue_.PopFront();
+            count_ -= waiter.count;
+            waiter.granted.store(true, std::memory_order_relaxed);
+            stats_.OnWaiters(--waiters_);
+            parking_lot::UnparkOne(&waiter);
+        }
+    }
+
+    ParkingMutex mutex_;
     int count_ = 0;
-    int new_index_ = 0;
-    int next_index_ = 0;
+    List<Waiter> queue_;
+    size_t waiters_ = 0;
+    [[no_unique_address]] LockStats stats_;
 };
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "backoff.h"
+
+// Sequence lock for small trivially copyable values. Readers never write
+// shared memory: they copy the value optimistically and retry if a writer
+// ran meanwhile (sequence changed or was odd). Writers serialize on the
+// sequence itself.
+//
+// Value is kept in relaxed atomic words, so a torn copy is a well-defined
+// read that just gets discarded.
+template <class T>
+    requires std::is_trivially_copyable_v<T>
+class SeqLock {
+public:
+    SeqLock() : SeqLock(T{}) {
+    }
+
+    explicit SeqLock(const T& value) {
+        Write(value);
+    }
+
+    T Load() const {
+        SpinBackoff backoff;
+        while (true) {
+            uint64_t before = seq_.load(std::memory_order_acquire);
+            if (!(before & 1)) {
+                Words words;
+                for (size_t i = 0; i < kWords; ++i) {
+                    words[i] = data_[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq_.load(std::memory_order_relaxed) == before) {
+                    return FromWords(words);
+                }
+            }
+            backoff.Pause();
+        }
+    }
+
+    void Store(const T& value) {
+        uint64_t seq = LockWrite();
+        Write(value);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Runs func(T&) on the current value under the writer lock
+    template <class Func>
+    void Update(Func func) {
+        uint64_t seq = LockWrite();
+        Words words;
+        for (size_t i = 0; i < kWords; ++i) {
+            words[i] = data_[i].load(std::memory_order_relaxed);
+        }
+        T value = FromWords(words);
+        func(value);
+        Write(value);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t kWords = (sizeof(T) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+
+    using Words = std::array<uintptr_t, kWords>;
+
+    static T FromWords(const Words& words) {
+        std::array<unsigned char, sizeof(T)> bytes;
+        std::memcpy(bytes.data(), words.data(), sizeof(T));
+        return std::bit_cast<T>(bytes);
+    }
+
+    // Makes sequence odd, returns its previous (even) value
+    uint64_t LockWrite() {
+        SpinBackoff backoff;
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        while (true) {
+            if (!(seq & 1) &&
+                seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_relaxed)) {
+                // orders the odd sequence before the data stores below
+                std::atomic_thread_fence(std::memory_order_release);
+                return seq;
+            }
+            backoff.Pause();
+            seq = seq_.load(std::memory_order_relaxed);
+        }
+    }
+
+    void Write(const T& value) {
+        Words words{};
+        std::memcpy(words.data(), &value, sizeof(T));
+        for (size_t i = 0; i < kWords; ++i) {
+            data_[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> seq_ = 0;
+    std::atomic<uintptr_t> data_[kWords];
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+// Channel for exactly one sending and one receiving thread.
+//
+// Producer owns tail_, consumer owns head_, each on its own cache line next
+// to a cached copy of the other side's index, so the shared line is read only
+// when the ring looks full (or empty). SendMany/RecvMany publish the index
+// once per batch. A side parks on a futex word only when the ring is really
+// full or empty, and the other side notifies only when it knows somebody parked.
+template <class T>
+class SPSCChannel {
+public:
+    explicit SPSCChannel(size_t size) : size_(size), mask_(RoundUp(size) - 1), slots_(new Slot[mask_ + 1]) {
+        assert(size > 0);
+    }
+
+    SPSCChannel(const SPSCChannel&) = delete;
+    SPSCChannel& operator=(const SPSCChannel&) = delete;
+
+    ~SPSCChannel() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        for (size_t head = head_.load(std::memory_order_relaxed); head != tail; ++head) {
+            slots_[head & mask_].Get()->~T();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Producer side
+
+    void Send(const T& value) {
+        Emplace(value);
+    }
+
+    void Send(T&& value) {
+        Emplace(std::move(value));
+    }
+
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        WaitFreeSpace(tail);
+        new (slots_[tail & mask_].Get()) T(std::forward<Args>(args)...);
+        Publish(tail_, tail + 1, recv_parked_, recv_wake_);
+    }
+
+    // Returns false if channel is full
+    template <class... Args>
+    bool TryEmplace(Args&&... args) {
+        if (closed_.load(std::memory_order_relaxed)) {
+            throw std::runtime_error("");
+        }
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (FreeSpace(tail) == 0) {
+            return false;
+        }
+        new (slots_[tail & mask_].Get()) T(std::forward<Args>(args)...);
+        Publish(tail_, tail + 1, recv_parked_, recv_wake_);
+        return true;
+    }
+
+    // Writes as many values as fit and publishes them with one store.
+    void SendMany(std::span<const T> values) {
+        size_t sent = 0;
+        while (sent < values.size()) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t count = std::min(WaitFreeSpace(tail), values.size() - sent);
+            for (size_t i = 0; i < count; ++i) {
+                new (slots_[(tail + i) & mask_].Get()) T(values[sent + i]);
+            }
+            sent += count;
+            Publish(tail_, tail + count, recv_parked_, recv_wake_);
+        }
+    }
+
+    void Close() {
+        closed_ = true;
+        recv_wake_.fetch_add(1);
+        recv_wake_.notify_all();
+        send_wake_.fetch_add(1);
+        send_wake_.notify_all();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Consumer side
+
+    // Returns std::nullopt once channel is closed and drained
+    std::optional<T> Recv() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (!WaitValues(head)) {
+            return std::nullopt;
+        }
+        std::optional<T> result = Take(head);
+        Publish(head_, head + 1, send_parked_, send_wake_);
+        return result;
+    }
+
+    std::optional<T> TryRecv() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (Available(head) == 0) {
+            return std::nullopt;
+        }
+        std::optional<T> result = Take(head);
+        Publish(head_, head + 1, send_parked_, send_wake_);
+        return result;
+    }
+
+    // Moves up to max values to out and frees their slots with one store.
+    // Blocks until at least min values are taken or channel is closed.
+    template <class OutputIt>
+    size_t RecvMany(OutputIt out, size_t max, size_t min = 1) {
+        min = std::min(std::max<size_t>(min, 1), max);
+        size_t count = 0;
+        while (count < min) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t available = WaitValues(head);
+            if (available == 0) {
+                break;
+            }
+            size_t take = std::min(available, max - count);
+            for (size_t i = 0; i < take; ++i) {
+                *out++ = Take(head + i);
+            }
+            count += take;
+            Publish(head_, head + take, send_parked_, send_wake_);
+        }
+        return count;
+    }
+
+private:
+    static constexpr int kSpinCount = 128;
+    static constexpr size_t kCacheLine = 64;
+
+    struct Slot {
+        T* Get() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static size_t RoundUp(size_t count) {
+        size_t result = 1;
+        while (result < count) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    size_t FreeSpace(size_t tail) {
+        if (tail - cached_head_ == size_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+        }
+        return size_ - (tail - cached_head_);
+    }
+
+    size_t Available(size_t head) {
+        if (cached_tail_ == head) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+        }
+        return cached_tail_ - head;
+    }
+
+    T Take(size_t head) {
+        T* value = slots_[head & mask_].Get();
+        T result(std::move(*value));
+        value->~T();
+        return result;
+    }
+
+    // Blocks while ring is full, throws if channel is closed
+    size_t WaitFreeSpace(size_t tail) {
+        return Wait([&] {
+            if (closed_.load(std::memory_order_relaxed)) {
+                throw std::runtime_error("");
+            }
+            return FreeSpace(tail);
+        }, send_parked_, send_wake_);
+    }
+
+    // Blocks while ring is empty, returns 0 if channel is closed and drained
+    size_t WaitValues(size_t head) {
+        return Wait([&]() -> size_t {
+            if (size_t available = Available(head)) {
+                return available;
+            }
+            if (closed_.load(std::memory_order_acquire)) {
+                // producer may have published right before Close
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                return cached_tail_ - head;
+            }
+            return 0;
+        }, recv_parked_, recv_wake_);
+    }
+
+    // ready() returning 0 means "keep waiting" unless channel is closed
+    template <class Ready>
+    size_t Wait(Ready ready, std::atomic<bool>& parked, std::atomic<uint32_t>& wake) {
+        for (int i = 0; i < kSpinCount; ++i) {
+            if (size_t result = ready()) {
+                return result;
+            }
+            if (closed_.load(std::memory_order_relaxed)) {
+                return ready();
+            }
+        }
+        while (true) {
+            uint32_t epoch = wake.load();
+            parked.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            size_t result = ready();
+            if (result || closed_) {
+                parked.store(false, std::memory_order_relaxed);
+                return result;
+            }
+            wake.wait(epoch);
+            parked.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Pairs with the fence in Wait: either the parked side sees the new
+    // index, or we see it parked.
+    static void Publish(std::atomic<size_t>& index, size_t value, std::atomic<bool>& parked,
+                        std::atomic<uint32_t>& wake) {
+        index.store(value, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed)) {
+            wake.fetch_add(1);
+            wake.notify_one();
+        }
+    }
+
+    const size_t size_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic_bool closed_ = false;
+
+    alignas(kCacheLine) std::atomic<size_t> tail_ = 0;
+    size_t cached_head_ = 0;
+
+    alignas(kCacheLine) std::atomic<size_t> head_ = 0;
+    size_t cached_tail_ = 0;
+
+    alignas(kCacheLine) std::atomic<bool> send_parked_ = false;
+    std::atomic<uint32_t> send_wake_ = 0;
+
+    alignas(kCacheLine) std::atomic<bool> recv_parked_ = false;
+    std::atomic<uint32_t> recv_wake_ = 0;
+};
@@ -0,0 +1,524 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "backoff.h"
+#include "node_pool.h"
+#include "parking_lot.h"
+#include "work_stealing_deque.h"
+
+class ThreadPool;
+
+namespace thread_pool_detail {
+
+// Unit of work, Run executes it and frees it
+class Task {
+public:
+    virtual void Run() = 0;
+
+protected:
+    ~Task() = default;
+
+private:
+    friend class ::ThreadPool;
+
+    Task* next_ = nullptr;
+};
+
+// Runs one pending task of the pool current thread works for, returns false
+// if there is none or current thread is not a worker
+inline bool RunPendingTask();
+
+// Result slot shared by the task and its Future. The task holds one
+// reference until it has run, the future holds the other.
+template <class T>
+class FutureState {
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    virtual ~FutureState() = default;
+
+    bool IsReady() const {
+        return state_.load(std::memory_order_acquire) == kReady;
+    }
+
+    void Wait() {
+        SpinBackoff backoff;
+        while (!IsReady()) {
+            if (RunPendingTask()) {
+                backoff.Reset();
+            } else if (backoff.IsSpinning()) {
+                backoff.Pause();
+            } else {
+                uint32_t state = kPending;
+                state_.compare_exchange_strong(state, kWaiting, std::memory_order_relaxed);
+                parking_lot::Park(&state_, [&] {
+                    return state_.load(std::memory_order_relaxed) == kWaiting;
+                });
+            }
+        }
+    }
+
+    T Get() {
+        Wait();
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*value_);
+        }
+    }
+
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+protected:
+    template <class F>
+    void Complete(F& func) {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                func();
+                value_.emplace();
+            } else {
+                value_.emplace(func());
+            }
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        if (state_.exchange(kReady, std::memory_order_acq_rel) == kWaiting) {
+            parking_lot::UnparkAll(&state_);
+        }
+    }
+
+private:
+    static constexpr uint32_t kPending = 0;
+    static constexpr uint32_t kReady = 1;
+    static constexpr uint32_t kWaiting = 2;
+
+    std::atomic<uint32_t> state_ = kPending;
+    std::atomic<uint32_t> refs_ = 2;
+    std::optional<Value> value_;
+    std::exception_ptr error_;
+};
+
+// Task and its future state in one pooled allocation
+template <class F, class T>
+class PackagedTask final : public Task, public FutureState<T> {
+public:
+    explicit PackagedTask(F func) : func_(std::move(func)) {
+    }
+
+    void Run() override {
+        this->Complete(*func_);
+        func_.reset();
+        this->Release();
+    }
+
+    static void* operator new(size_t) {
+        return NodePool<PackagedTask>::Allocate();
+    }
+
+    static void operator delete(void* ptr) {
+        NodePool<PackagedTask>::Deallocate(ptr);
+    }
+
+private:
+    std::optional<F> func_;
+};
+
+// Task without a result, exception escaping func terminates the program
+template <class F>
+class DetachedTask final : public Task {
+public:
+    explicit DetachedTask(F func) : func_(std::move(func)) {
+    }
+
+    void Run() override {
+        func_();
+        delete this;
+    }
+
+    static void* operator new(size_t) {
+        return NodePool<DetachedTask>::Allocate();
+    }
+
+    static void operator delete(void* ptr) {
+        NodePool<DetachedTask>::Deallocate(ptr);
+    }
+
+private:
+    F func_;
+};
+
+}  // namespace thread_pool_detail
+
+// Result of ThreadPool::Submit. Get and Wait called from a pool worker run
+// other pending tasks instead of blocking, so a task may submit subtasks and
+// wait for them (fork-join) without starving the pool.
+template <class T>
+class Future {
+public:
+    Future() = default;
+
+    Future(Future&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {
+    }
+
+    Future& operator=(Future&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            state_ = std::exchange(other.state_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Future() {
+        Reset();
+    }
+
+    bool IsValid() const {
+        return state_ != nullptr;
+    }
+
+    bool IsReady() const {
+        return state_->IsReady();
+    }
+
+    void Wait() const {
+        state_->Wait();
+    }
+
+    // Waits for the task, returns its result or rethrows its exception.
+    // Future becomes invalid.
+    T Get() {
+        std::unique_ptr<thread_pool_detail::FutureState<T>, Releaser> state(
+            std::exchange(state_, nullptr));
+        return state->Get();
+    }
+
+private:
+    friend class ThreadPool;
+
+    struct Releaser {
+        void operator()(thread_pool_detail::FutureState<T>* state) const {
+            state->Release();
+        }
+    };
+
+    explicit Future(thread_pool_detail::FutureState<T>* state) : state_(state) {
+    }
+
+    void Reset() {
+        if (state_) {
+            std::exchange(state_, nullptr)->Release();
+        }
+    }
+
+    thread_pool_detail::FutureState<T>* state_ = nullptr;
+};
+
+// Work-stealing pool. Every worker owns a Chase-Lev deque: tasks submitted
+// from a worker go to the bottom of its own deque and are popped LIFO, which
+// keeps recursive work hot in cache, while idle workers steal the oldest
+// (and usually biggest) tasks from the top. Tasks from other threads go to a
+// global injection queue, a worker takes a batch of them at once into its
+// deque. Workers with nothing to do spin for a while, then park.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_threads = std::thread::hardware_concurrency()) {
+        num_threads = std::max<size_t>(num_threads, 1);
+        workers_.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers_.push_back(std::make_unique<Worker>());
+            workers_.back()->rng = i * 0x9e3779b97f4a7c15 + 1;
+        }
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers_[i]->thread = std::thread([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs all submitted tasks, including the ones they submit, then joins
+    // workers. Must not be called from a worker.
+    ~ThreadPool() {
+        stopped_.store(true, std::memory_order_seq_cst);
+        wake_epoch_.fetch_add(1, std::memory_order_release);
+        parking_lot::UnparkAll(&wake_epoch_);
+        for (auto& worker : workers_) {
+            worker->thread.join();
+        }
+    }
+
+    size_t Size() const {
+        return workers_.size();
+    }
+
+    // Submit schedules func() and returns future for its result.
+    //
+    // Safe to call from multiple threads, including pool workers.
+    template <class F>
+    auto Submit(F&& func) {
+        using Result = std::invoke_result_t<std::decay_t<F>&>;
+        auto* task = new thread_pool_detail::PackagedTask<std::decay_t<F>, Result>(std::forward<F>(func));
+        Future<Result> future(task);
+        Schedule(task, task, 1);
+        return future;
+    }
+
+    // Execute schedules func() without a future. Cheaper than Submit, but an
+    // exception escaping func terminates the program.
+    template <class F>
+    void Execute(F&& func) {
+        Schedule(new thread_pool_detail::DetachedTask<std::decay_t<F>>(std::forward<F>(func)));
+    }
+
+    // SubmitBatch schedules every callable of funcs at once: one lock of the
+    // injection queue and one round of wakeups for the whole batch. Returns
+    // futures in the same order.
+    template <class Range>
+    auto SubmitBatch(Range&& funcs) {
+        using F = std::decay_t<decltype(*std::begin(funcs))>;
+        using Result = std::invoke_result_t<F&>;
+        std::vector<Future<Result>> futures;
+        Task* first = nullptr;
+        Task* last = nullptr;
+        size_t count = 0;
+        using Packaged = thread_pool_detail::PackagedTask<F, Result>;
+        try {
+            for (auto&& func : funcs) {
+                auto* task = new Packaged(std::forward<decltype(func)>(func));
+                (last ? last->next_ : first) = task;
+                last = task;
+                ++count;
+                futures.push_back(Future<Result>(task));
+            }
+        } catch (...) {
+            // nothing is scheduled yet, tasks drop the reference they hold
+            // for the pool and die with their futures
+            while (first) {
+                static_cast<Packaged*>(std::exchange(first, first->next_))->Release();
+            }
+            throw;
+        }
+        if (count) {
+            Schedule(first, last, count);
+        }
+        return futures;
+    }
+
+private:
+    using Task = thread_pool_detail::Task;
+
+    friend bool thread_pool_detail::RunPendingTask();
+
+    static constexpr size_t kMaxInjectedBatch = 32;
+
+    struct alignas(64) Worker {
+        WorkStealingDeque<Task> deque;
+        uint64_t rng = 0;
+        std::thread thread;
+    };
+
+    struct CurrentWorker {
+        ThreadPool* pool = nullptr;
+        size_t index = 0;
+    };
+
+    static CurrentWorker& Current() {
+        static thread_local CurrentWorker current;
+        return current;
+    }
+
+    void Schedule(Task* task) {
+        task->next_ = nullptr;
+        Schedule(task, task, 1);
+    }
+
+    // Schedules linked list of count tasks
+    void Schedule(Task* first, Task* last, size_t count) {
+        last->next_ = nullptr;
+        CurrentWorker& current = Current();
+        if (current.pool == this) {
+            WorkStealingDeque<Task>& deque = workers_[current.index]->deque;
+            while (first) {
+                deque.Push(std::exchange(first, first->next_));
+            }
+        } else {
+            std::lock_guard<ParkingMutex> lock(injection_mutex_);
+            (injection_tail_ ? injection_tail_->next_ : injection_head_) = first;
+            injection_tail_ = last;
+            injected_.fetch_add(count, std::memory_order_relaxed);
+        }
+        Notify(count);
+    }
+
+    // Wakes up to count parked workers
+    void Notify(size_t count) {
+        // pairs with the sleepers_ increment in WaitTask: either the worker
+        // sees the new tasks or we see it going to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        wake_epoch_.fetch_add(1, std::memory_order_release);
+        for (size_t i = 0; i < count; ++i) {
+            if (!parking_lot::UnparkOne(&wake_epoch_).have_more) {
+                break;
+            }
+        }
+    }
+
+    void WorkerLoop(size_t index) {
+        Current() = {this, index};
+        while (Task* task = WaitTask(index)) {
+            task->Run();
+        }
+        Current() = {};
+    }
+
+    // Returns next task to run, nullptr once the pool is stopped and drained
+    Task* WaitTask(size_t index) {
+        SpinBackoff backoff;
+        while (true) {
+            if (Task* task = FindTask(index)) {
+                return task;
+            }
+            if (backoff.IsSpinning()) {
+                backoff.Pause();
+                continue;
+            }
+            uint64_t epoch = wake_epoch_.load(std::memory_order_acquire);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            Task* task = FindTask(index);
+            if (!task && !stopped_.load(std::memory_order_seq_cst)) {
+                parking_lot::Park(&wake_epoch_, [&] {
+                    return wake_epoch_.load(std::memory_order_relaxed) == epoch;
+                });
+            }
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            if (task) {
+                return task;
+            }
+            if (stopped_.load(std::memory_order_acquire) && !HasTasks()) {
+                return nullptr;
+            }
+            backoff.Reset();
+        }
+    }
+
+    Task* FindTask(size_t index) {
+        if (Task* task = workers_[index]->deque.Pop()) {
+            return task;
+        }
+        if (Task* task = TakeInjected(index)) {
+            return task;
+        }
+        return Steal(index);
+    }
+
+    // Takes a task from the injection queue and moves a batch of the ones
+    // behind it to the worker deque, where other workers can steal them
+    Task* TakeInjected(size_t index) {
+        if (injected_.load(std::memory_order_seq_cst) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<ParkingMutex> lock(injection_mutex_);
+        size_t available = injected_.load(std::memory_order_relaxed);
+        if (available == 0) {
+            return nullptr;
+        }
+        size_t take = std::min({available / workers_.size() + 1, available, kMaxInjectedBatch});
+        Task* task = injection_head_;
+        injection_head_ = task->next_;
+        for (size_t i = 1; i < take; ++i) {
+            Task* next = injection_head_;
+            injection_head_ = next->next_;
+            workers_[index]->deque.Push(next);
+        }
+        if (!injection_head_) {
+            injection_tail_ = nullptr;
+        }
+        injected_.fetch_sub(take, std::memory_order_relaxed);
+        return task;
+    }
+
+    // Tries every other worker once, starting from a random one
+    Task* Steal(size_t index) {
+        size_t count = workers_.size();
+        if (count == 1) {
+            return nullptr;
+        }
+        uint64_t& rng = workers_[index]->rng;
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t start = rng % count;
+        for (size_t i = 0; i < count; ++i) {
+            size_t victim = (start + i) % count;
+            if (victim == index) {
+                continue;
+            }
+            if (Task* task = workers_[victim]->deque.Steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool HasTasks() const {
+        if (injected_.load(std::memory_order_seq_cst) != 0) {
+            return true;
+        }
+        for (const auto& worker : workers_) {
+            if (!worker->deque.IsEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    ParkingMutex injection_mutex_;
+    Task* injection_head_ = nullptr;
+    Task* injection_tail_ = nullptr;
+    std::atomic<size_t> injected_ = 0;
+
+    alignas(64) std::atomic<uint64_t> wake_epoch_ = 0;
+    std::atomic<size_t> sleepers_ = 0;
+    std::atomic<bool> stopped_ = false;
+};
+
+namespace thread_pool_detail {
+
+inline bool RunPendingTask() {
+    auto [pool, index] = ThreadPool::Current();
+    if (!pool) {
+        return false;
+    }
+    Task* task = pool->FindTask(index);
+    if (!task) {
+        return false;
+    }
+    task->Run();
+    return true;
+}
+
+}  // namespace thread_pool_detail
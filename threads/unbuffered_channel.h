@@ -1,67 +1,365 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <utility>
 #include <optional>
-#include <condition_variable>
 #include <mutex>
+#include <span>
+#include <stdexcept>
 
+#include "backoff.h"
+#include "instrumentation.h"
+#include "parking_lot.h"
+#include "select.h"
+
+// Blocked senders and receivers wait in FIFO queues of records living on
+// their own stacks. Whoever comes second completes the handoff under the
+// mutex: receiver copies straight from the sender's span, sender copies
+// straight into the receiver's slot. Waiting side spins briefly and then
+// parks on its own flag in the global parking lot, so every handoff costs at
+// most one targeted wakeup. The channel itself is a one byte lock and two
+// queue pointers.
 template <class T>
 class UnbufferedChannel {
 public:
+    using ValueType = T;
+
     void Send(const T& value) {
+        SendMany(std::span<const T>(&value, 1));
+    }
+
+    // SendMany hands values to receivers in order and returns once every
+    // value is taken.
+    void SendMany(std::span<const T> values) {
+        if (values.empty()) {
+            return;
+        }
+        RecvWaiter* wake = nullptr;
+        SendWaiter self{.values = values.data(), .size = values.size()};
+        bool queued = false;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            while (!closed_ && state_ != 0) {
-                can_send_.wait(lock);
-            }
+            std::lock_guard<ParkingMutex> lock(mutex_);
             if (closed_) {
                 throw std::runtime_error("");
             }
-            ++state_;
-            recv_ = value;
-            has_value_.notify_one();
-            while (!closed_ && state_ != 2) {
-                value_getted_.wait(lock);
+            while (self.taken < self.size && !recv_queue_.IsEmpty()) {
+                RecvWaiter* waiter = recv_queue_.Pop();
+                *waiter->slot = self.values[self.taken++];
+                waiter->next = wake;
+                wake = waiter;
             }
-            if (closed_ && state_ != 2) {
-                throw std::runtime_error("");
+            if (self.taken) {
+                stats_.OnRecv(blocked_senders_, self.taken);
+            }
+            if (self.taken < self.size) {
+                send_queue_.Push(&self);
+                ++blocked_senders_;
+                select_waiters_.NotifyAll();
+                queued = true;
             }
-            state_ = 0;
-            recv_.reset();
+            stats_.OnSend(blocked_senders_, self.size);
+        }
+        WakeAll(wake);
+        if (!queued) {
+            return;
+        }
+        {
+            [[maybe_unused]] auto timer = stats_.SendBlocked();
+            Park(self.done);
+        }
+        if (self.taken != self.size) {
+            throw std::runtime_error("");
         }
-        can_send_.notify_one();
     }
 
     std::optional<T> Recv() {
         std::optional<T> res;
+        RecvWaiter self{.slot = &res};
+        SendWaiter* wake = nullptr;
+        bool queued = false;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            while (!closed_ && state_ != 1) {
-                has_value_.wait(lock);
-            }
+            std::lock_guard<ParkingMutex> lock(mutex_);
             if (closed_) {
                 return std::nullopt;
             }
-            res = recv_;
-            ++state_;
+            if (send_queue_.IsEmpty()) {
+                recv_queue_.Push(&self);
+                select_waiters_.NotifyAll();
+                queued = true;
+            } else {
+                wake = TakeFromSender(&res);
+                self.done = true;
+            }
+        }
+        WakeAll(wake);
+        if (queued) {
+            [[maybe_unused]] auto timer = stats_.RecvBlocked();
+            Park(self.done);
         }
-        value_getted_.notify_one();
         return res;
     }
 
+    // RecvMany takes up to max values, possibly from several senders, under
+    // one lock acquisition. Blocks until at least min values are taken or
+    // channel is closed. Returns number of received values.
+    template <class OutputIt>
+    size_t RecvMany(OutputIt out, size_t max, size_t min = 1) {
+        min = std::min(std::max<size_t>(min, 1), max);
+        size_t count = 0;
+        SendWaiter* wake = nullptr;
+        std::unique_lock<ParkingMutex> lock(mutex_);
+        while (count < max && !closed_) {
+            if (SendWaiter* sender = send_queue_.Head()) {
+                size_t take = std::min(max - count, sender->size - sender->taken);
+                out = std::copy_n(sender->values + sender->taken, take, out);
+                sender->taken += take;
+                count += take;
+                if (sender->taken == sender->size) {
+                    send_queue_.Pop();
+                    --blocked_senders_;
+                    sender->next = wake;
+                    wake = sender;
+                }
+                stats_.OnRecv(blocked_senders_, take);
+                continue;
+            }
+            if (count >= min) {
+                break;
+            }
+            std::optional<T> value;
+            RecvWaiter self{.slot = &value};
+            recv_queue_.Push(&self);
+            select_waiters_.NotifyAll();
+            lock.unlock();
+            WakeAll(wake);
+            wake = nullptr;
+            {
+                [[maybe_unused]] auto timer = stats_.RecvBlocked();
+                Park(self.done);
+            }
+            if (!value) {
+                return count;
+            }
+            *out++ = std::move(*value);
+            ++count;
+            lock.lock();
+        }
+        lock.unlock();
+        WakeAll(wake);
+        return count;
+    }
+
     void Close() {
-        closed_ = true;
-        can_send_.notify_all();
-        has_value_.notify_all();
-        value_getted_.notify_all();
+        SendWaiter* senders = nullptr;
+        RecvWaiter* receivers = nullptr;
+        {
+            std::lock_guard<ParkingMutex> lock(mutex_);
+            closed_ = true;
+            senders = send_queue_.Detach();
+            receivers = recv_queue_.Detach();
+            blocked_senders_ = 0;
+            select_waiters_.NotifyAll();
+        }
+        WakeAll(senders);
+        WakeAll(receivers);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Non-blocking operations used by Select. self is the hook of the
+    // calling case: its Select, if blocked, is claimed right before the case
+    // fires.
+
+    // Returns false unless some receiver is already blocked in Recv or in a
+    // Select, then hands value to it.
+    bool PollSend(const T& value, SelectCaseHook* self = nullptr) {
+        RecvWaiter* waiter = nullptr;
+        {
+            std::lock_guard<ParkingMutex> lock(mutex_);
+            if (closed_) {
+                if (!ClaimSelectCase(self)) {
+                    return false;
+                }
+                throw std::runtime_error("");
+            }
+            if (recv_queue_.IsEmpty()) {
+                SelectCaseHook* peer = select_waiters_.ClaimPeer(self, false);
+                if (!peer) {
+                    return false;
+                }
+                *static_cast<std::optional<T>*>(peer->value) = value;
+                stats_.OnSend(blocked_senders_);
+                stats_.OnRecv(blocked_senders_);
+                peer->waiter->Notify();
+                return true;
+            }
+            if (!ClaimSelectCase(self)) {
+                return false;
+            }
+            waiter = recv_queue_.Pop();
+            *waiter->slot = value;
+            waiter->next = nullptr;
+            stats_.OnSend(blocked_senders_);
+            stats_.OnRecv(blocked_senders_);
+        }
+        WakeAll(waiter);
+        return true;
+    }
+
+    // Returns false if there is no sender and channel is not closed, value
+    // stays std::nullopt if channel is closed.
+    bool PollRecv(std::optional<T>& value, SelectCaseHook* self = nullptr) {
+        SendWaiter* wake = nullptr;
+        {
+            std::lock_guard<ParkingMutex> lock(mutex_);
+            if (closed_) {
+                return ClaimSelectCase(self);
+            }
+            if (send_queue_.IsEmpty()) {
+                SelectCaseHook* peer = select_waiters_.ClaimPeer(self, true);
+                if (!peer) {
+                    return false;
+                }
+                value = *static_cast<const T*>(peer->value);
+                stats_.OnSend(blocked_senders_);
+                stats_.OnRecv(blocked_senders_);
+                peer->waiter->Notify();
+                return true;
+            }
+            if (!ClaimSelectCase(self)) {
+                return false;
+            }
+            wake = TakeFromSender(&value);
+        }
+        WakeAll(wake);
+        return true;
+    }
+
+    void AddSelectWaiter(SelectCaseHook* hook) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        select_waiters_.Add(hook);
+    }
+
+    void RemoveSelectWaiter(SelectCaseHook* hook) {
+        std::lock_guard<ParkingMutex> lock(mutex_);
+        select_waiters_.Remove(hook);
+    }
+
+    const ChannelStats& GetStats() const {
+        return stats_;
     }
 
 private:
-    std::mutex mutex_;
-    std::condition_variable can_send_;
-    std::condition_variable has_value_;
-    std::condition_variable value_getted_;
-    std::optional<T> recv_;
-    int state_ = 0;
-    std::atomic_bool closed_ = false;
-};
\ No newline at end of file
+    static constexpr int kSpinCount = 100;
+
+    struct SendWaiter {
+        const T* values;
+        size_t size;
+        size_t taken = 0;
+        SendWaiter* next = nullptr;
+        std::atomic<bool> done = false;
+    };
+
+    struct RecvWaiter {
+        std::optional<T>* slot;
+        RecvWaiter* next = nullptr;
+        std::atomic<bool> done = false;
+    };
+
+    // Circular list addressed by its tail, tail->next is the head
+    template <class Waiter>
+    class WaiterQueue {
+    public:
+        bool IsEmpty() const {
+            return !tail_;
+        }
+
+        Waiter* Head() const {
+            return tail_ ? tail_->next : nullptr;
+        }
+
+        void Push(Waiter* waiter) {
+            if (tail_) {
+                waiter->next = tail_->next;
+                tail_->next = waiter;
+            } else {
+                waiter->next = waiter;
+            }
+            tail_ = waiter;
+        }
+
+        Waiter* Pop() {
+            Waiter* waiter = tail_->next;
+            if (waiter == tail_) {
+                tail_ = nullptr;
+            } else {
+                tail_->next = waiter->next;
+            }
+            return waiter;
+        }
+
+        // Empties the queue, returns its waiters as a nullptr-terminated list
+        Waiter* Detach() {
+            if (!tail_) {
+                return nullptr;
+            }
+            Waiter* head = tail_->next;
+            tail_->next = nullptr;
+            tail_ = nullptr;
+            return head;
+        }
+
+    private:
+        Waiter* tail_ = nullptr;
+    };
+
+    // Takes one value from the first queued sender, returns the sender if it
+    // has to be woken up.
+    SendWaiter* TakeFromSender(std::optional<T>* slot) {
+        SendWaiter* sender = send_queue_.Head();
+        *slot = sender->values[sender->taken++];
+        if (sender->taken < sender->size) {
+            stats_.OnRecv(blocked_senders_);
+            return nullptr;
+        }
+        send_queue_.Pop();
+        --blocked_senders_;
+        stats_.OnRecv(blocked_senders_);
+        sender->next = nullptr;
+        return sender;
+    }
+
+    // Waiter may return and destroy its record as soon as done is set, so
+    // next is read before that. Unparking a stale address is harmless: a
+    // thread parked there rechecks its flag.
+    template <class Waiter>
+    static void WakeAll(Waiter* waiter) {
+        while (waiter) {
+            Waiter* next = waiter->next;
+            waiter->done.store(true, std::memory_order_release);
+            parking_lot::UnparkOne(&waiter->done);
+            waiter = next;
+        }
+    }
+
+    static void Park(std::atomic<bool>& done) {
+        for (int i = 0; i < kSpinCount; ++i) {
+            if (done.load(std::memory_order_acquire)) {
+                return;
+            }
+            CpuRelax();
+        }
+        while (!done.load(std::memory_order_acquire)) {
+            parking_lot::Park(&done, [&] { return !done.load(std::memory_order_acquire); });
+        }
+    }
+
+    ParkingMutex mutex_;
+    bool closed_ = false;
+    uint32_t blocked_senders_ = 0;
+    WaiterQueue<SendWaiter> send_queue_;
+    WaiterQueue<RecvWaiter> recv_queue_;
+    SelectWaiterList select_waiters_;
+    [[no_unique_address]] ChannelStats stats_;
+};
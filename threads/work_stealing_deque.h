@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev work-stealing deque of pointers (after Le, Pop, Cohen and
+// Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+// Models"). Owner pushes and pops at the bottom without atomic RMW except
+// when racing for the last element; thieves take from the top with one CAS.
+// Ring grows when full, old rings are kept until the deque dies because a
+// thief may still read from them.
+template <class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        rings_.push_back(std::make_unique<Ring>(capacity));
+        ring_.store(rings_.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only
+    void Push(T* item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        Ring* ring = ring_.load(std::memory_order_relaxed);
+        if (bottom - top >= static_cast<int64_t>(ring->Capacity())) {
+            ring = Grow(ring, top, bottom);
+        }
+        ring->Put(bottom, item);
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Owner only, returns nullptr if deque is empty
+    T* Pop() {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Ring* ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_seq_cst);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = ring->Get(bottom);
+        if (top == bottom) {
+            // last element, race with thieves for it
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread, returns nullptr if deque is empty or the race was lost
+    T* Steal() {
+        int64_t top = top_.load(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_seq_cst);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        T* item = ring_.load(std::memory_order_acquire)->Get(top);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool IsEmpty() const {
+        return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+    }
+
+private:
+    class Ring {
+    public:
+        explicit Ring(size_t capacity) : mask_(capacity - 1), slots_(new std::atomic<T*>[capacity]) {
+        }
+
+        size_t Capacity() const {
+            return mask_ + 1;
+        }
+
+        T* Get(int64_t index) const {
+            return slots_[index & mask_].load(std::memory_order_relaxed);
+        }
+
+        void Put(int64_t index, T* item) {
+            slots_[index & mask_].store(item, std::memory_order_relaxed);
+        }
+
+    private:
+        size_t mask_;
+        std::unique_ptr<std::atomic<T*>[]> slots_;
+    };
+
+    Ring* Grow(Ring* ring, int64_t top, int64_t bottom) {
+        rings_.push_back(std::make_unique<Ring>(ring->Capacity() * 2));
+        Ring* grown = rings_.back().get();
+        for (int64_t i = top; i < bottom; ++i) {
+            grown->Put(i, ring->Get(i));
+        }
+        ring_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(64) std::atomic<int64_t> top_ = 0;
+    alignas(64) std::atomic<int64_t> bottom_ = 0;
+    std::atomic<Ring*> ring_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+};